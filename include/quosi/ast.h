@@ -15,6 +15,9 @@ struct quosiVertexIfElseBlock;
 struct quosiVertexIfElse;
 struct quosiVertexMatchArm;
 struct quosiVertexMatch;
+struct quosiVertexRandomArm;
+struct quosiVertexRandom;
+struct quosiVertexImport;
 
 struct quosiEdgeIfElseBlock;
 struct quosiEdgeIfElse;
@@ -36,6 +39,9 @@ typedef struct quosiVertexIfElseBlock quosiVertexIfElseBlock;
 typedef struct quosiVertexIfElse      quosiVertexIfElse;
 typedef struct quosiVertexMatchArm    quosiVertexMatchArm;
 typedef struct quosiVertexMatch       quosiVertexMatch;
+typedef struct quosiVertexRandomArm   quosiVertexRandomArm;
+typedef struct quosiVertexRandom      quosiVertexRandom;
+typedef struct quosiVertexImport      quosiVertexImport;
 
 typedef struct quosiEdgeIfElseBlock quosiEdgeIfElseBlock;
 typedef struct quosiEdgeIfElse      quosiEdgeIfElse;
@@ -48,11 +54,16 @@ typedef struct quosiVertexBlock   quosiVertexBlock;
 
 
 struct quosiExpr {
-    enum quosiExprType { QUOSI_EXPR_IDENT, QUOSI_EXPR_IMM, QUOSI_EXPR_OP } tag;
+    enum quosiExprType { QUOSI_EXPR_IDENT, QUOSI_EXPR_IMM, QUOSI_EXPR_OP, QUOSI_EXPR_VISITS, QUOSI_EXPR_CALL } tag;
     union {
         quosiStrView ident;
         uint64_t imm;
         uint8_t op;
+        struct {
+            quosiStrView name;
+            // vector
+            quosiExpr* args;
+        } call;
     } value;
     quosiExpr* lhs;
     quosiExpr* rhs;
@@ -117,6 +128,22 @@ struct quosiVertexMatch {
     quosiVertex catchall;
 };
 
+struct quosiVertexRandomArm {
+    uint64_t weight;
+    quosiVertex body;
+};
+
+struct quosiVertexRandom {
+    // vector
+    quosiVertexRandomArm* arms;
+};
+
+struct quosiVertexImport {
+    quosiStrView module;
+    // vector, vertices of the importer bound to the exit parameters of module, in order
+    quosiStrView* exits;
+};
+
 
 struct quosiEdgeIfElseBlock {
     quosiExpr cond;
@@ -148,11 +175,13 @@ struct quosiEdgeMatch {
 
 
 struct quosiVertexBlock {
-    enum quosiVblockType { QUOSI_VBLOCK_T, QUOSI_VBLOCK_MATCH, QUOSI_VBLOCK_IFELSE } tag;
+    enum quosiVblockType { QUOSI_VBLOCK_T, QUOSI_VBLOCK_MATCH, QUOSI_VBLOCK_IFELSE, QUOSI_VBLOCK_RANDOM, QUOSI_VBLOCK_IMPORT } tag;
     union {
         quosiVertex vertex;
         quosiVertexMatch match;
         quosiVertexIfElse ifelse;
+        quosiVertexRandom random;
+        quosiVertexImport import;
     } value;
 };
 
@@ -173,21 +202,48 @@ typedef struct quosiNamedVertex {
 } quosiNamedVertex;
 
 
+// compile time constant, 'const NAME = N' or a member of 'enum SCOPE { NAME, ... }'
+typedef struct quosiConstant {
+    // empty for 'const' and anonymous enums, otherwise referenced as SCOPE.NAME
+    quosiStrView scope;
+    quosiStrView name;
+    uint64_t value;
+} quosiConstant;
+
+
 typedef struct quosiGraph {
     quosiStrView name;
+    // vector, exit parameters, an edge naming one returns to the importing module
+    quosiStrView* params;
     // vector
     quosiNamedVertex* vertices;
+    // vector
+    quosiConstant* constants;
+    // vector, open addressed table over vertex and parameter names, length is a power of two
+    uint32_t* index;
     // std::pmr::unordered_map<std::string_view, std::string_view> rename_table;
 } quosiGraph;
 
 typedef struct quosiAst {
+    // every string view of the tree points into it, errors found after parsing are located through it
+    const char* src;
     // vector
     quosiGraph* modules;
+    // vector, declared outside of any module
+    quosiConstant* constants;
 } quosiAst;
 
 
 quosiAst quosi_ast_parse_from_src(const char* src, quosiError* errors, quosiAllocator alloc);
 void quosi_ast_free(const quosiAst* ast, quosiAllocator alloc);
+// live[i] is set for each vertex that START leads to through edges, jumps and imports, or for all of them if there is no START
+void quosi_graph_reachable(const quosiGraph* graph, bool* live, quosiAllocator alloc);
+// enters vertex i (or exit parameter i) under its name, false if the name is already taken
+bool quosi_graph_index(quosiGraph* graph, uint32_t i, bool param, quosiAllocator alloc);
+// FNV-1a, shared by every table keyed on source names
+uint32_t quosi_name_hash(quosiStrView name);
+// label of the vertex or exit parameter (labelled after the vertices) called name, UINT32_MAX if there is none
+uint32_t quosi_graph_find(const quosiGraph* graph, quosiStrView name);
 
 
 #endif
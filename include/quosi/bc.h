@@ -39,6 +39,21 @@ enum quosiInstr {
     QUOSI_INSTR_PICK,
     QUOSI_INSTR_LINE,
     QUOSI_INSTR_EVENT,
+    QUOSI_INSTR_RAND,
+    QUOSI_INSTR_VISIT,
+    QUOSI_INSTR_SEEN,
+    QUOSI_INSTR_CALL,
+    QUOSI_INSTR_CALLM,
+    QUOSI_INSTR_RETX,
+    QUOSI_INSTR_LINET,
+    QUOSI_INSTR_PROPT,
+    // TSAVE r copies the top of the stack into temporary r, TLOAD r pushes it back
+    QUOSI_INSTR_TSAVE,
+    QUOSI_INSTR_TLOAD,
+    // PROBE k counts into the profile of a vm capturing one, see quosi_vm_profile
+    QUOSI_INSTR_PROBE,
+    // patched over an instruction by quosi_file_set_break, never emitted by the compiler
+    QUOSI_INSTR_BREAK,
 };
 
 typedef struct quosiModData {
@@ -51,13 +66,26 @@ typedef struct quosiModData {
 typedef struct quosiProgramData {
     // vector
     quosiModData* mods;
+    // number of PROBE IDs handed out
+    uint32_t nprobes;
+    // vector, code several modules share, placed behind the code of the last one
+    uint8_t* common;
     // vector
     uint8_t* strs;
+    // vector, segment tables of strings containing ${...}
+    uint8_t* tmpl;
+    // vector, string offset of each event name, indexed by event ID
+    uint8_t* evts;
+    // vector, [id, speaker, str] of every line sorted by id
+    uint8_t* lines;
+    // vector, [mod, name, entry] of every vertex sorted by module then name
+    uint8_t* verts;
     // vector
     uint8_t* syms;
 } quosiProgramData;
 
-quosiProgramData quosi_compile_ast(const struct quosiAst* ast, quosiSymbolCtx ctx, quosiAllocator alloc);
+// errors found while generating code are appended to errors, the result is only meaningful if none of them is critical
+quosiProgramData quosi_compile_ast(const struct quosiAst* ast, quosiSymbolCtx ctx, const quosiCompileOptions* opts, quosiError* errors, quosiAllocator alloc);
 void quosi_program_data_free(quosiProgramData* data, quosiAllocator alloc);
 
 
@@ -40,14 +40,31 @@ typedef struct quosiErrorValue {
         QUOSI_ERR_UNCLOSED_PAREN,
         QUOSI_ERR_UNCLOSED_ANGLE,
         QUOSI_ERR_UNCLOSED_CONDITIONAL,
+        QUOSI_ERR_INVALID_WEIGHT,
+        QUOSI_ERR_TOO_MANY_COUNTERS,
+        QUOSI_ERR_UNKNOWN_FUNCTION,
+        QUOSI_ERR_TOO_MANY_ARGUMENTS,
+        QUOSI_ERR_BAD_CONSTANT,
+        QUOSI_ERR_DUPLICATE_CONSTANT,
+        QUOSI_ERR_UNKNOWN_MODULE,
+        QUOSI_ERR_BAD_IMPORT,
+        QUOSI_ERR_INVALID_UTF8,
+        QUOSI_ERR_UNREACHABLE_VERTEX,
+        QUOSI_ERR_TOO_MANY_EDGES,
+        QUOSI_ERR_ASSIGN_PINNED,
+        QUOSI_ERR_STACK_OVERFLOW,
+        QUOSI_ERR_LINE_ID_COLLISION,
     } type;
     quosiErrorSpan span;
 } quosiErrorValue;
 
 const char* quosi_error_to_string(quosiErrorValue e);
 bool quosi_error_is_critical(quosiErrorValue e);
+// warnings are reported but do not stop compilation
+bool quosi_error_is_warning(quosiErrorValue e);
 
-// error list result from parsing. if no errors were found, list == NULL.
+// error list result from compiling. if no errors were found, list == NULL. warnings are only listed
+// when quosiCompileOptions.warnings is set. a file is still compiled when every entry is a warning.
 typedef struct quosiError  {
     quosiErrorValue* list;
     bool critical;
@@ -127,8 +144,44 @@ typedef struct quosiSymbolCtx {
     uint32_t(*data_lkp)(const char*);
     // maps speaker names to integer IDs
     uint32_t(*speaker_lkp)(const char*);
+    // maps native function names to indices into the table bound with quosi_vm_bind, UINT32_MAX for names
+    // the host does not know. may be NULL, then every call is an error
+    uint32_t(*func_lkp)(const char*);
 } quosiSymbolCtx;
 
+enum quosiOptLevel {
+    // lowers the code exactly as generated
+    QUOSI_OPT_NONE = 0,
+    // folds constants, drops dead branches and unreachable vertices and reuses loads. code may be left out,
+    // but what remains keeps the source's order and each vertex has its own copy
+    QUOSI_OPT_DEFAULT,
+    // additionally merges identical code within and across modules, threads jumps and moves vertices, and
+    // applies a captured profile. trades debuggability for size and speed
+    QUOSI_OPT_FULL,
+};
+// a key the host promises holds value for as long as the file is in use. a script assigning it is an error
+typedef struct quosiPin {
+    uint32_t key;
+    uint64_t value;
+} quosiPin;
+typedef struct quosiCompileOptions {
+    uint32_t opt_level;
+    // lists warnings, such as unreachable vertices, alongside errors. list is then non-NULL on success
+    // too, so the caller frees it either way
+    bool warnings;
+    // reads of pinned keys compile to their values, so conditions on them fold away and arms that can
+    // no longer be taken are dropped. the file is specialized to the pins, compile one per set
+    const quosiPin* pins;
+    uint32_t npins;
+    // emits a PROBE at every vertex and at every arm whose test may be reordered, for capturing a profile
+    bool probes;
+    // counts captured with a probed build of the same source, lays out hot vertices together and tests
+    // the most taken arms first. only read at QUOSI_OPT_FULL. NULL for none, a profile of any other source
+    // is harmless but useless
+    const uint32_t* profile;
+    uint32_t profile_len;
+} quosiCompileOptions;
+
 // metadata for the compiled binary, always makes up first N bytes of the blob
 typedef struct quosiFileHeader {
     char magic[5];
@@ -139,9 +192,22 @@ typedef struct quosiFileHeader {
     uint32_t nmods;
     uint32_t code_pos;
     uint32_t strs_pos;
+    uint32_t tmpl_pos;
+    uint32_t evts_pos;
+    uint32_t line_pos;
+    uint32_t vert_pos;
     uint32_t syms_pos;
+    // counters a profile of the file needs, 0 unless compiled with probes
+    uint32_t nprobes;
 } quosiFileHeader;
 
+// entry of the line table, id is the one handed out by quosi_vm_line_id
+typedef struct quosiFileLine {
+    uint32_t id;
+    uint32_t speaker;
+    const char* text;
+} quosiFileLine;
+
 // metadata for a single module, entry is an offset from *code, not *file
 typedef struct quosiFileModTableEntry {
     const uint8_t* code;
@@ -149,19 +215,51 @@ typedef struct quosiFileModTableEntry {
     uint32_t entry;
 } quosiFileModTableEntry;
 
-// return complete compiled binary as single contiguous blob, including header, module table, modules and strings
-quosiFile* quosi_file_compile_from_src(const char* src, quosiError* errors, quosiSymbolCtx ctx, quosiAllocator alloc);
-// return complete compiled binary as single contiguous blob, including header, module table, modules and strings
-quosiFile* quosi_file_compile_from_ast(const struct quosiAst* ast, quosiSymbolCtx ctx, quosiAllocator alloc);
+// return complete compiled binary as single contiguous blob, including header, module table, modules and strings.
+// opts may be NULL for QUOSI_OPT_DEFAULT
+quosiFile* quosi_file_compile_from_src(const char* src, quosiError* errors, quosiSymbolCtx ctx, const quosiCompileOptions* opts, quosiAllocator alloc);
+// compiled program held until it is written into caller memory, such as a mapped output file, so the exact
+// file size is known before that memory is provided and without compiling twice
+typedef struct quosiFileBuild quosiFileBuild;
+// NULL if src has errors (listed in errors). opts may be NULL for QUOSI_OPT_DEFAULT
+quosiFileBuild* quosi_file_build(const char* src, quosiError* errors, quosiSymbolCtx ctx, const quosiCompileOptions* opts, quosiAllocator alloc);
+// exact number of bytes quosi_file_build_write fills
+size_t quosi_file_build_size(const quosiFileBuild* build);
+// lays the file out straight in buf, without an intermediate blob. buf holds at least quosi_file_build_size bytes
+// and must be aligned like memory returned by malloc. may be called any number of times
+void quosi_file_build_write(const quosiFileBuild* build, void* buf);
+void quosi_file_build_free(quosiFileBuild* build);
+// return complete compiled binary as single contiguous blob, including header, module table, modules and strings.
+// errors found while generating code, such as too many visit counters, are appended to errors and NULL is returned
+quosiFile* quosi_file_compile_from_ast(const struct quosiAst* ast, quosiError* errors, quosiSymbolCtx ctx, const quosiCompileOptions* opts, quosiAllocator alloc);
 // outputs human readable (asm-like) representation of a single module
 void quosi_file_prettyprint(const quosiFile* file, const char* module, void* stdstream);
 
+// copy of file that breakpoints can be patched into, the original is left untouched. the copy keeps the
+// pristine code region behind its end so the vm can resume from a breakpoint, free it like any other file
+quosiFile* quosi_file_debug_copy(const quosiFile* file, quosiAllocator alloc);
+// at is an instruction offset within the module's code, such as one returned by quosi_file_vertex.
+// only valid on a debug copy, false if at is out of range or not the start of an instruction
+bool quosi_file_set_break(quosiFile* file, uint32_t module, uint32_t at);
+bool quosi_file_clear_break(quosiFile* file, uint32_t module, uint32_t at);
+
+// every string handed out by a quosiFile or quosiVm (lines, propositions, events, module names)
+// is stored as [u32 len][bytes]\0 and is valid UTF-8, this reads the length without scanning
+quosiStrView quosi_strview(const char* str);
+
 const quosiFileHeader* quosi_file_header(const quosiFile* file);
 quosiFileModTableEntry quosi_file_module(const quosiFile* file, const char* module);
+// index is the position of the module in the source, as referenced by CALLM
+quosiFileModTableEntry quosi_file_module_by_index(const quosiFile* file, uint32_t index);
+// UINT32_MAX if the file has no such module
+uint32_t quosi_file_module_index(const quosiFile* file, const char* module);
+// offset from the module's *code of the named vertex, UINT32_MAX if the module has no such vertex
+uint32_t quosi_file_vertex(const quosiFile* file, uint32_t module, const char* vertex);
 
 // one byte past the end of the whole blob
 const uint8_t* quosi_file_end(const quosiFile* file);
 size_t quosi_file_len(const quosiFile* file);
+uint32_t quosi_file_probe_count(const quosiFile* file);
 
 const uint8_t* quosi_file_mod_table(const quosiFile* file);
 size_t quosi_file_mod_table_len(const quosiFile* file);
@@ -169,6 +267,25 @@ const uint8_t* quosi_file_code(const quosiFile* file);
 size_t quosi_file_code_len(const quosiFile* file);
 const uint8_t* quosi_file_strs(const quosiFile* file);
 size_t quosi_file_strs_len(const quosiFile* file);
+// records of [str, nsegs, [key, off, len] * nsegs], see quosiTextSegment
+const uint8_t* quosi_file_tmpl(const quosiFile* file);
+size_t quosi_file_tmpl_len(const quosiFile* file);
+// string offset of each event name, indexed by the ID handed out with QUOSI_UPCALL_EVENT
+const uint8_t* quosi_file_evts(const quosiFile* file);
+size_t quosi_file_evts_len(const quosiFile* file);
+uint32_t quosi_file_event_count(const quosiFile* file);
+// name of an event for debugging, NULL if id is out of range
+const char* quosi_file_event(const quosiFile* file, uint32_t id);
+// every line of the file sorted by ID, IDs derive from module, vertex and position within the vertex
+const uint8_t* quosi_file_lines(const quosiFile* file);
+size_t quosi_file_lines_len(const quosiFile* file);
+uint32_t quosi_file_line_count(const quosiFile* file);
+quosiFileLine quosi_file_line(const quosiFile* file, uint32_t index);
+// text is NULL if no line has this ID
+quosiFileLine quosi_file_line_find(const quosiFile* file, uint32_t id);
+// records of [mod, name, entry] sorted by module index, then by name in strcmp order
+const uint8_t* quosi_file_verts(const quosiFile* file);
+size_t quosi_file_verts_len(const quosiFile* file);
 const uint8_t* quosi_file_syms(const quosiFile* file);
 size_t quosi_file_syms_len(const quosiFile* file);
 
@@ -11,13 +11,34 @@ enum quosiUpcall {
     QUOSI_UPCALL_EVENT,
     QUOSI_UPCALL_EXIT,
     QUOSI_UPCALL_ABORT,
+    // hit a breakpoint of a debug copy, the next exec runs the instruction it displaced
+    QUOSI_UPCALL_BREAK,
 };
+// each key must have storage of its own. compiled code may reuse a value it read through a key
+// until the next upcall or native call, instead of asking for it again
 typedef uint64_t*(*quosiVmCtx)(uint32_t key);
+// native function callable from scripts as name(args...), args[0] is the leftmost argument
+typedef uint64_t(*quosiVmNative)(const uint64_t* args, uint32_t argc);
 typedef struct quosiProposition {
     const char* str;
-    uint8_t idx;
+    // position of the option within its choice, what the host pushes to pick it
+    uint16_t idx;
+    // segment table of str, QUOSI_TEMPLATE_NONE if str has no ${...}
+    uint32_t tmpl;
 } quosiProposition;
 
+#define QUOSI_TEMPLATE_NONE   UINT32_MAX
+#define QUOSI_SEGMENT_LITERAL UINT32_MAX
+
+// piece of a template string, text is not null terminated. a literal run if key == QUOSI_SEGMENT_LITERAL,
+// otherwise text is the name inside ${...} and key its ID as handed out by quosiSymbolCtx.data_lkp
+typedef struct quosiTextSegment {
+    const char* text;
+    uint32_t len;
+    uint32_t key;
+} quosiTextSegment;
+
+// capacity of the built in proposition queue, larger menus need quosi_vm_prop_buffer
 #ifndef QUOSI_PROP_QUEUE_SIZE
 #define QUOSI_PROP_QUEUE_SIZE 16
 #endif
@@ -26,31 +47,98 @@ typedef struct quosiProposition {
 #define QUOSI_VALUE_STACK_SIZE 128
 #endif
 
+// number of vertices per file whose visits can be tested with 'once' or 'visits(...)'
+#ifndef QUOSI_VISIT_COUNTER_SIZE
+#define QUOSI_VISIT_COUNTER_SIZE 256
+#endif
+
+// depth of nested imports, each import vertex entered pushes one frame until the module returns
+#ifndef QUOSI_CALL_STACK_SIZE
+#define QUOSI_CALL_STACK_SIZE 8
+#endif
+
+// scratch registers of TSAVE and TLOAD, part of the bytecode format so not configurable
+#define QUOSI_TEMP_REGISTER_COUNT 8
+
 #define QUOSI_VERTEX_START 0
 #define QUOSI_VERTEX_EXIT  UINT32_MAX
 
+typedef struct quosiVmFrame {
+    const uint8_t* code;
+    // of the importer's CALLM target table
+    uint32_t PC;
+} quosiVmFrame;
+
 typedef struct quosiVm {
     quosiProposition text[QUOSI_PROP_QUEUE_SIZE];
     uint64_t stack[QUOSI_VALUE_STACK_SIZE];
+    // never live across an upcall, so saving the vm need not keep them
+    uint64_t T[QUOSI_TEMP_REGISTER_COUNT];
+    // saturating, part of the vm state so saving the vm saves them
+    uint8_t visits[QUOSI_VISIT_COUNTER_SIZE];
+    quosiVmFrame frames[QUOSI_CALL_STACK_SIZE];
     uint32_t PC, SP;
+    uint32_t FP;
     uint32_t TH, TT;
     uint32_t A,  B;
+    uint32_t C,  D;
+    // set while stopped at a breakpoint
+    uint32_t BK;
+    uint64_t R;
     const uint8_t* base;
     const uint8_t* code;
     const uint8_t* strs;
+    const uint8_t* tmpl;
+    const uint8_t* evts;
+    const quosiVmNative* natives;
+    uint32_t nnatives;
+    // caller supplied proposition queue, NULL to use text
+    quosiProposition* props;
+    uint32_t pcap;
+    // caller supplied profile counters, NULL unless capturing
+    uint32_t* profile;
+    uint32_t nprofile;
 } quosiVm;
 
 void quosi_vm_init(quosiVm* self, const quosiFile* file, const char* module);
+// as init but enters at the named vertex, false leaves the vm at the module's entry
+bool quosi_vm_init_at(quosiVm* self, const quosiFile* file, const char* module, const char* vertex);
+// moves to the entry of module, keeping visit counters and generator state
+void quosi_vm_restart(quosiVm* self, const quosiFile* file, const char* module);
+// reseeds the generator behind 'random' blocks, init always seeds with the same constant
+void quosi_vm_seed(quosiVm* self, uint64_t seed);
+// binds the native function table, indexed by the IDs handed out by quosiSymbolCtx.func_lkp
+void quosi_vm_bind(quosiVm* self, const quosiVmNative* natives, uint32_t count);
+// capture mode, every PROBE adds one to counts[ID]. counts needs quosi_file_probe_count entries and is
+// passed back to the compiler as quosiCompileOptions.profile, NULL stops capturing
+void quosi_vm_profile(quosiVm* self, uint32_t* counts, uint32_t len);
 
-const char* quosi_vm_line(const quosiVm* self);
+// line text after QUOSI_UPCALL_LINE, event name after QUOSI_UPCALL_EVENT
+const char*  quosi_vm_line(const quosiVm* self);
+quosiStrView quosi_vm_line_view(const quosiVm* self);
+// speaker ID after QUOSI_UPCALL_LINE, event ID (index into the file's event table) after QUOSI_UPCALL_EVENT
 uint32_t    quosi_vm_id(const quosiVm* self);
 uint32_t    quosi_vm_nq(const quosiVm* self);
+// stable ID of the current line, see quosi_file_line_find
+uint32_t    quosi_vm_line_id(const quosiVm* self);
+// segment table of the current line, QUOSI_TEMPLATE_NONE if the line has no ${...}
+uint32_t    quosi_vm_line_template(const quosiVm* self);
+
+uint32_t         quosi_vm_template_len(const quosiVm* self, uint32_t tmpl);
+quosiTextSegment quosi_vm_template_segment(const quosiVm* self, uint32_t tmpl, uint32_t i);
 
 void             quosi_vm_push_value(quosiVm* self, uint64_t val);
 uint64_t         quosi_vm_pop_value(quosiVm* self);
 uint64_t         quosi_vm_top_value(const quosiVm* self);
 quosiProposition quosi_vm_dequeue_text(quosiVm* self);
 
+// replaces the built in proposition queue, NULL restores it. exec aborts instead of overflowing either
+void     quosi_vm_prop_buffer(quosiVm* self, quosiProposition* buffer, uint32_t cap);
+// number of options of the pending choice whether or not their conditions passed, valid after QUOSI_UPCALL_PICK
+uint32_t quosi_vm_choice_len(const quosiVm* self);
+// sets bit idx of mask for every option on offer, mask needs (quosi_vm_choice_len + 63) / 64 words
+void     quosi_vm_prop_mask(const quosiVm* self, uint64_t* mask, uint32_t nwords);
+
 int quosi_vm_exec(quosiVm* self, quosiVmCtx ctx);
 
 
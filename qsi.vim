@@ -8,8 +8,9 @@ syn match   Constant   /[0-9]\+/    contained
 syn match   String     /"\([^\\"]\?\(\\[\\"tn]\)\?\)*"/
 syn match   Comment    /#.*\n/
 
-syn keyword Macro        rename module endmod
-syn keyword Constant     true false inf _
-syn keyword Conditional  if then else match with end
+syn keyword Macro        rename module endmod const enum import
+syn keyword Constant     true false inf once _
+syn keyword Function     visits
+syn keyword Conditional  if then else match random with end
 syn keyword Error        START EXIT
 
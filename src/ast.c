@@ -3,11 +3,17 @@
 #include "quosi/quosi.h"
 #define QUOSIDS_ALLOCATOR alloc
 #include "vec.h"
+#include <string.h>
 #include <stdio.h>
 
 
 static void quosi_expr_free(quosiExpr* expr, quosiAllocator alloc) {
-    if (expr->tag == QUOSI_EXPR_OP) {
+    if (expr->tag == QUOSI_EXPR_CALL) {
+        for (size_t i = 0; i < quosids_arrlenu(expr->value.call.args); i++) {
+            quosi_expr_free(&expr->value.call.args[i], alloc);
+        }
+        quosids_arrfree(expr->value.call.args);
+    } else if (expr->tag == QUOSI_EXPR_OP) {
         quosi_expr_free(expr->lhs, alloc);
         quosi_allocator_deallocate(alloc, expr->lhs);
         if (expr->value.op != QUOSI_INSTR_NEG && expr->value.op != QUOSI_INSTR_LNOT) {
@@ -106,6 +112,17 @@ static void quosi_vertifelse_free(quosiVertexIfElse* ifelse, quosiAllocator allo
     quosi_allocator_deallocate(alloc, ifelse->catchall);
 }
 
+static void quosi_vertrandom_free(quosiVertexRandom* random, quosiAllocator alloc) {
+    for (size_t i = 0; i < quosids_arrlenu(random->arms); i++) {
+        quosi_vertex_free(&random->arms[i].body, alloc);
+    }
+    quosids_arrfree(random->arms);
+}
+
+static void quosi_vertimport_free(quosiVertexImport* import, quosiAllocator alloc) {
+    quosids_arrfree(import->exits);
+}
+
 static void quosi_vertblock_free(quosiVertexBlock* block, quosiAllocator alloc) {
     switch (block->tag) {
     case QUOSI_VBLOCK_T:
@@ -117,6 +134,12 @@ static void quosi_vertblock_free(quosiVertexBlock* block, quosiAllocator alloc)
     case QUOSI_VBLOCK_IFELSE:
         quosi_vertifelse_free(&block->value.ifelse, alloc);
         break;
+    case QUOSI_VBLOCK_RANDOM:
+        quosi_vertrandom_free(&block->value.random, alloc);
+        break;
+    case QUOSI_VBLOCK_IMPORT:
+        quosi_vertimport_free(&block->value.import, alloc);
+        break;
     }
 }
 
@@ -124,7 +147,10 @@ static void quosi_graph_free(quosiGraph* graph, quosiAllocator alloc) {
     for (size_t i = 0; i < quosids_arrlenu(graph->vertices); i++) {
         quosi_vertblock_free(&graph->vertices[i].data, alloc);
     }
+    quosids_arrfree(graph->params);
     quosids_arrfree(graph->vertices);
+    quosids_arrfree(graph->constants);
+    quosids_arrfree(graph->index);
 }
 
 void quosi_ast_free(const quosiAst* _ast, quosiAllocator alloc) {
@@ -133,5 +159,166 @@ void quosi_ast_free(const quosiAst* _ast, quosiAllocator alloc) {
         quosi_graph_free(&ast->modules[i], alloc);
     }
     quosids_arrfree(ast->modules);
+    quosids_arrfree(ast->constants);
+}
+
+
+
+// index slots hold i + 1, tagged for exit parameters, 0 is empty
+#define QUOSI_INDEX_PARAM 0x80000000u
+
+uint32_t quosi_name_hash(quosiStrView name) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < name.len; i++) {
+        h = (h ^ (uint8_t)name.ptr[i]) * 16777619u;
+    }
+    return h;
+}
+static quosiStrView quosi_index_name(const quosiGraph* graph, uint32_t slot) {
+    const uint32_t i = (slot & ~QUOSI_INDEX_PARAM) - 1;
+    return (slot & QUOSI_INDEX_PARAM) ? graph->params[i] : graph->vertices[i].name;
+}
+// slot holding name, or the empty slot it belongs in
+static uint32_t* quosi_index_probe(uint32_t* index, const quosiGraph* graph, quosiStrView name) {
+    const size_t mask = quosids_arrlenu(index) - 1;
+    for (size_t h = quosi_name_hash(name) & mask;; h = (h + 1) & mask) {
+        if (index[h] == 0) return &index[h];
+        const quosiStrView v = quosi_index_name(graph, index[h]);
+        if (v.len == name.len && strncmp(v.ptr, name.ptr, name.len) == 0) return &index[h];
+    }
+}
+
+bool quosi_graph_index(quosiGraph* graph, uint32_t i, bool param, quosiAllocator alloc) {
+    // kept at most half full, every name ever entered counts towards the load
+    const size_t cap = quosids_arrlenu(graph->index);
+    const size_t count = quosids_arrlenu(graph->vertices) + quosids_arrlenu(graph->params);
+    if (2 * count > cap) {
+        uint32_t* index = NULL;
+        const size_t ncap = (cap == 0) ? 16 : cap * 2;
+        quosids_arraddn(index, ncap);
+        memset(index, 0, ncap * sizeof(uint32_t));
+        for (size_t j = 0; j < cap; j++) {
+            if (graph->index[j] != 0) {
+                *quosi_index_probe(index, graph, quosi_index_name(graph, graph->index[j])) = graph->index[j];
+            }
+        }
+        quosids_arrfree(graph->index);
+        graph->index = index;
+    }
+    const uint32_t entry = (i + 1) | (param ? QUOSI_INDEX_PARAM : 0);
+    uint32_t* slot = quosi_index_probe(graph->index, graph, quosi_index_name(graph, entry));
+    if (*slot != 0) return false;
+    *slot = entry;
+    return true;
+}
+
+uint32_t quosi_graph_find(const quosiGraph* graph, quosiStrView name) {
+    if (graph->index == NULL) return UINT32_MAX;
+    const uint32_t slot = *quosi_index_probe(graph->index, graph, name);
+    if (slot == 0) return UINT32_MAX;
+    const uint32_t i = (slot & ~QUOSI_INDEX_PARAM) - 1;
+    return (slot & QUOSI_INDEX_PARAM) ? (uint32_t)quosids_arrlenu(graph->vertices) + i : i;
+}
+
+
+
+typedef struct quosiReachState {
+    const quosiGraph* graph;
+    bool* live;
+    // vector, vertices marked but not yet walked
+    uint32_t* work;
+} quosiReachState;
+
+static void quosi_reach_name(quosiReachState* st, quosiStrView name, quosiAllocator alloc) {
+    // EXIT, exit parameters and dangling names are not vertices of this graph
+    const uint32_t i = quosi_graph_find(st->graph, name);
+    if (i < (uint32_t)quosids_arrlenu(st->graph->vertices) && !st->live[i]) {
+        st->live[i] = true;
+        quosids_arrpush(st->work, i);
+    }
+}
+
+static void quosi_reach_edgeblock(quosiReachState* st, const quosiEdgeBlock* block, quosiAllocator alloc) {
+    switch (block->tag) {
+    case QUOSI_EBLOCK_T:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.edges); i++) {
+            quosi_reach_name(st, block->value.edges[i].next, alloc);
+        }
+        break;
+    case QUOSI_EBLOCK_MATCH:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.match.arms); i++) {
+            quosi_reach_name(st, block->value.match.arms[i].body.next, alloc);
+        }
+        if (block->value.match.catchall.exists) {
+            quosi_reach_name(st, block->value.match.catchall.arm.next, alloc);
+        }
+        break;
+    case QUOSI_EBLOCK_IFELSE:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.ifelse.blocks); i++) {
+            for (size_t j = 0; j < quosids_arrlenu(block->value.ifelse.blocks[i].body); j++) {
+                quosi_reach_edgeblock(st, &block->value.ifelse.blocks[i].body[j], alloc);
+            }
+        }
+        for (size_t i = 0; i < quosids_arrlenu(block->value.ifelse.catchall); i++) {
+            quosi_reach_edgeblock(st, &block->value.ifelse.catchall[i], alloc);
+        }
+        break;
+    }
 }
 
+static void quosi_reach_vertex(quosiReachState* st, const quosiVertex* vert, quosiAllocator alloc) {
+    if (vert->type == QUOSI_VERTEX_JUMP) {
+        quosi_reach_name(st, vert->v.jump.next, alloc);
+    } else {
+        for (size_t i = 0; i < quosids_arrlenu(vert->v.edges); i++) {
+            quosi_reach_edgeblock(st, &vert->v.edges[i], alloc);
+        }
+    }
+}
+
+static void quosi_reach_vertblock(quosiReachState* st, const quosiVertexBlock* block, quosiAllocator alloc) {
+    switch (block->tag) {
+    case QUOSI_VBLOCK_T:
+        quosi_reach_vertex(st, &block->value.vertex, alloc);
+        break;
+    case QUOSI_VBLOCK_MATCH:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.match.arms); i++) {
+            quosi_reach_vertex(st, &block->value.match.arms[i].body, alloc);
+        }
+        quosi_reach_vertex(st, &block->value.match.catchall, alloc);
+        break;
+    case QUOSI_VBLOCK_IFELSE:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.ifelse.blocks); i++) {
+            quosi_reach_vertblock(st, block->value.ifelse.blocks[i].data, alloc);
+        }
+        quosi_reach_vertblock(st, block->value.ifelse.catchall, alloc);
+        break;
+    case QUOSI_VBLOCK_RANDOM:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.random.arms); i++) {
+            quosi_reach_vertex(st, &block->value.random.arms[i].body, alloc);
+        }
+        break;
+    case QUOSI_VBLOCK_IMPORT:
+        for (size_t i = 0; i < quosids_arrlenu(block->value.import.exits); i++) {
+            quosi_reach_name(st, block->value.import.exits[i], alloc);
+        }
+        break;
+    }
+}
+
+void quosi_graph_reachable(const quosiGraph* graph, bool* live, quosiAllocator alloc) {
+    const size_t nverts = quosids_arrlenu(graph->vertices);
+    quosiReachState st = { graph, live, NULL };
+    memset(live, 0, nverts * sizeof(bool));
+    quosi_reach_name(&st, (quosiStrView){ "START", 5 }, alloc);
+    if (quosids_arrlenu(st.work) == 0) {
+        // without START there is nothing to measure against
+        memset(live, 1, nverts * sizeof(bool));
+        return;
+    }
+    while (quosids_arrlenu(st.work) > 0) {
+        const uint32_t v = st.work[--quosids_header(st.work)->len];
+        quosi_reach_vertblock(&st, &graph->vertices[v].data, alloc);
+    }
+    quosids_arrfree(st.work);
+}
@@ -4,12 +4,23 @@
 #include "lex.h"
 
 
+typedef struct quosiImportRef {
+    quosiToken module;
+    size_t arity;
+} quosiImportRef;
+
 typedef struct quosiParseCtx {
     quosiAllocator alloc;
     quosiTokenStream tokens;
     quosiError* errors;
     // vector
     quosiToken* edges;
+    // vector, name of each vertex of the module being parsed, in order
+    quosiToken* names;
+    // vector, checked against the module list once every module is known
+    quosiImportRef* imports;
+    // name of the vertex currently being parsed, target of 'once'
+    quosiStrView vertex;
 } quosiParseCtx;
 
 
@@ -25,6 +25,74 @@ static uint32_t jumps_get(const uint32_t* jumps, size_t njs, uint32_t target) {
     return 0;
 }
 
+quosiFile* quosi_file_debug_copy(const quosiFile* file, quosiAllocator alloc) {
+    // only opcodes are ever patched, so only the code region needs a pristine copy
+    const size_t len = quosi_file_len(file);
+    const size_t code_len = quosi_file_code_len(file);
+    uint8_t* copy = quosi_allocator_allocate(alloc, len + code_len);
+    memcpy(copy, file, len);
+    memcpy(copy + len, quosi_file_code(file), code_len);
+    return (quosiFile*)copy;
+}
+
+// bytes taken by the instruction at code, opcode included
+static uint32_t instr_size(const uint8_t* code) {
+    uint32_t n;
+    switch (code[0]) {
+    case QUOSI_INSTR_JUMP: case QUOSI_INSTR_JZ: case QUOSI_INSTR_JNZ:
+    case QUOSI_INSTR_LOAD: case QUOSI_INSTR_STORE: case QUOSI_INSTR_IEQK: case QUOSI_INSTR_EVENT:
+    case QUOSI_INSTR_VISIT: case QUOSI_INSTR_SEEN: case QUOSI_INSTR_RETX: case QUOSI_INSTR_PROBE:
+        return 1 + sizeof(uint32_t);
+    case QUOSI_INSTR_SWITCH:
+        memcpy(&n, code + 1, sizeof(uint32_t));
+        return 1 + (n + 1) * (uint32_t)sizeof(uint32_t);
+    case QUOSI_INSTR_RAND:
+        memcpy(&n, code + 1, sizeof(uint32_t));
+        return 1 + (3 * n + 1) * (uint32_t)sizeof(uint32_t);
+    case QUOSI_INSTR_CALLM:
+        memcpy(&n, code + 1 + sizeof(uint32_t), sizeof(uint32_t));
+        return 1 + (n + 2) * (uint32_t)sizeof(uint32_t);
+    case QUOSI_INSTR_PUSH: case QUOSI_INSTR_IEQV:
+        return 1 + sizeof(uint64_t);
+    case QUOSI_INSTR_PROP:  return 1 + sizeof(uint32_t) + sizeof(uint16_t);
+    case QUOSI_INSTR_PROPT: return 1 + 2 * sizeof(uint32_t) + sizeof(uint16_t);
+    case QUOSI_INSTR_LINE:  return 1 + 3 * sizeof(uint32_t);
+    case QUOSI_INSTR_LINET: return 1 + 4 * sizeof(uint32_t);
+    case QUOSI_INSTR_CALL:  return 2 + sizeof(uint32_t);
+    case QUOSI_INSTR_TSAVE: case QUOSI_INSTR_TLOAD:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+// pristine opcode of the instruction at, NULL unless at starts an instruction of the module. decoded from
+// the copy behind the file, since breakpoints already set would throw the walk off
+static uint8_t* break_site(quosiFile* file, uint32_t module, uint32_t at, const uint8_t** pristine) {
+    const quosiFileModTableEntry mod = quosi_file_module_by_index(file, module);
+    if (mod.code == NULL || at >= mod.len) return NULL;
+    const uint8_t* code = (const uint8_t*)file + quosi_file_len(file) + (mod.code - quosi_file_code(file));
+    uint32_t pc = 0;
+    while (pc < at) pc += instr_size(code + pc);
+    if (pc != at) return NULL;
+    *pristine = code + at;
+    return (uint8_t*)mod.code + at;
+}
+bool quosi_file_set_break(quosiFile* file, uint32_t module, uint32_t at) {
+    const uint8_t* pristine;
+    uint8_t* site = break_site(file, module, at, &pristine);
+    if (!site) return false;
+    *site = (uint8_t)QUOSI_INSTR_BREAK;
+    return true;
+}
+bool quosi_file_clear_break(quosiFile* file, uint32_t module, uint32_t at) {
+    const uint8_t* pristine;
+    uint8_t* site = break_site(file, module, at, &pristine);
+    if (!site) return false;
+    *site = *pristine;
+    return true;
+}
+
 void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _file) {
     const quosiFileModTableEntry mod = quosi_file_module(bin, module);
     const uint8_t* code    = mod.code;
@@ -35,9 +103,9 @@ void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _fil
 
     uint32_t PC = 0;
     uint8_t  a1 = 0;
+    uint16_t a16 = 0;
     uint32_t a2 = 0;
     uint64_t a3 = 0;
-    uint32_t skip = 0;
 
     uint32_t jumps[512] = { 0 };
     size_t njs = 0;
@@ -59,24 +127,67 @@ void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _fil
             if (!jumps_contains(jumps, njs, a2)) jumps[njs++] = a2;
             PC += sizeof(uint32_t);
             break;
-        case QUOSI_INSTR_SWITCH:
-            for (uint32_t i = 0; i < skip; i++) {
+        case QUOSI_INSTR_SWITCH: {
+            uint32_t n;
+            memcpy(&n, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            for (uint32_t i = 0; i < n; i++) {
                 memcpy(&a2, code + PC, sizeof(uint32_t));
                 if (!jumps_contains(jumps, njs, a2)) jumps[njs++] = a2;
                 PC += sizeof(uint32_t);
             }
-            skip = 0;
+            break; }
+        case QUOSI_INSTR_RAND:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            for (uint32_t i = 0; i < a2; i++) {
+                uint32_t col[3];
+                memcpy(col, code + PC, sizeof(col));
+                if (!jumps_contains(jumps, njs, col[1])) jumps[njs++] = col[1];
+                if (!jumps_contains(jumps, njs, col[2])) jumps[njs++] = col[2];
+                PC += sizeof(col);
+            }
+            break;
+        case QUOSI_INSTR_CALLM:
+            memcpy(&a2, code + PC + sizeof(uint32_t), sizeof(uint32_t));
+            PC += 2 * sizeof(uint32_t);
+            for (uint32_t i = 0; i < a2; i++) {
+                uint32_t t;
+                memcpy(&t, code + PC, sizeof(uint32_t));
+                if (!jumps_contains(jumps, njs, t)) jumps[njs++] = t;
+                PC += sizeof(uint32_t);
+            }
             break;
         case QUOSI_INSTR_PROP:
+            PC += sizeof(uint32_t) + sizeof(uint16_t);
+            break;
+        case QUOSI_INSTR_PUSH: case QUOSI_INSTR_IEQV:
+            PC += sizeof(uint64_t);
+            break;
+        case QUOSI_INSTR_LOAD: case QUOSI_INSTR_STORE: case QUOSI_INSTR_IEQK: case QUOSI_INSTR_EVENT:
+        case QUOSI_INSTR_VISIT: case QUOSI_INSTR_SEEN: case QUOSI_INSTR_RETX: case QUOSI_INSTR_PROBE:
+            PC += sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_LINE:
+            PC += 3 * sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_LINET:
+            PC += 4 * sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_PROPT:
+            PC += 2 * sizeof(uint32_t) + sizeof(uint16_t);
+            break;
+        case QUOSI_INSTR_CALL:
             PC += sizeof(uint32_t) + sizeof(uint8_t);
-            skip++;
+            break;
+        case QUOSI_INSTR_TSAVE: case QUOSI_INSTR_TLOAD:
+            PC += sizeof(uint8_t);
             break;
         default:
             break;
         }
     }
     PC = 0;
-    skip = 0;
     while (PC < code_len) {
         if (jumps_contains(jumps, njs, PC)) {
             fprintf(f, "    .L%d:\n", jumps_get(jumps, njs, PC));
@@ -109,6 +220,14 @@ void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _fil
             fprintf(f, "0x%04X    STORE @%u\n", PC-1, a2);
             PC += sizeof(uint32_t);
             break;
+        case QUOSI_INSTR_TSAVE:
+            fprintf(f, "0x%04X    TSAVE T%u\n", PC-1, (unsigned)code[PC]);
+            PC += sizeof(uint8_t);
+            break;
+        case QUOSI_INSTR_TLOAD:
+            fprintf(f, "0x%04X    TLOAD T%u\n", PC-1, (unsigned)code[PC]);
+            PC += sizeof(uint8_t);
+            break;
 
         case QUOSI_INSTR_LAND:
             fprintf(f, "0x%04X    LAND\n", PC-1);
@@ -177,26 +296,38 @@ void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _fil
             fprintf(f, "0x%04X    JNZ  .L%u\n", PC-1, jumps_get(jumps, njs, a2));
             PC += sizeof(uint32_t);
             break;
-        case QUOSI_INSTR_SWITCH:
+        case QUOSI_INSTR_SWITCH: {
+            uint32_t n;
             fprintf(f, "0x%04X    SWITCH [ ", PC-1);
-            for (uint32_t i = 0; i < skip; i++) {
+            memcpy(&n, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            for (uint32_t i = 0; i < n; i++) {
                 memcpy(&a2, code + PC, sizeof(uint32_t));
                 fprintf(f, ".L%u", jumps_get(jumps, njs, a2));
-                if (i < skip - 1) fprintf(f, ", ");
+                if (i < n - 1) fprintf(f, ", ");
                 PC += sizeof(uint32_t);
             }
             fprintf(f, " ]\n");
-            skip = 0;
-            break;
+            break; }
 
         case QUOSI_INSTR_PROP:
             fprintf(f, "0x%04X    ", PC-1);
             memcpy(&a2, code + PC, sizeof(uint32_t));
             PC += sizeof(uint32_t);
-            memcpy(&a1, code + PC, sizeof(uint8_t));
-            PC += sizeof(uint8_t);
-            fprintf(f, "PROP \"%s\", %d\n", (const char*)strs + a2, (int)a1);
-            skip++;
+            memcpy(&a16, code + PC, sizeof(uint16_t));
+            PC += sizeof(uint16_t);
+            fprintf(f, "PROP \"%s\", %d\n", (const char*)strs + a2, (int)a16);
+            break;
+        case QUOSI_INSTR_PROPT:
+            fprintf(f, "0x%04X    ", PC-1);
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            memcpy(&a16, code + PC, sizeof(uint16_t));
+            PC += sizeof(uint16_t);
+            fprintf(f, "PROPT \"%s\", %d, ", (const char*)strs + a2, (int)a16);
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "%%%u\n", a2);
             break;
         case QUOSI_INSTR_LINE:
             fprintf(f, "0x%04X    ", PC-1);
@@ -205,16 +336,88 @@ void quosi_file_prettyprint(const quosiFile* bin, const char* module, void* _fil
             fprintf(f, "LINE %u, \"", a2);
             memcpy(&a2, code + PC, sizeof(uint32_t));
             PC += sizeof(uint32_t);
-            fprintf(f, "%s\"\n", (const char*)(strs + a2));
+            fprintf(f, "%s\", ", (const char*)(strs + a2));
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "#%08X\n", a2);
+            break;
+        case QUOSI_INSTR_LINET:
+            fprintf(f, "0x%04X    ", PC-1);
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "LINET %u, \"", a2);
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "%s\", ", (const char*)(strs + a2));
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "#%08X, ", a2);
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            fprintf(f, "%%%u\n", a2);
             break;
         case QUOSI_INSTR_PICK:
             fprintf(f, "0x%04X    PICK\n", PC-1);
             break;
         case QUOSI_INSTR_EVENT:
             memcpy(&a2, code + PC, sizeof(uint32_t));
-            fprintf(f, "0x%04X    EVENT \"%s\"\n", PC-1, (const char*)strs + a2);
+            fprintf(f, "0x%04X    EVENT #%u \"%s\"\n", PC-1, a2, quosi_file_event(bin, a2));
+            PC += sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_CALL:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            PC += sizeof(uint32_t);
+            memcpy(&a1, code + PC, sizeof(uint8_t));
+            PC += sizeof(uint8_t);
+            fprintf(f, "0x%04X    CALL @%u, %d\n", PC-6, a2, (int)a1);
+            break;
+        case QUOSI_INSTR_VISIT:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            fprintf(f, "0x%04X    VISIT #%u\n", PC-1, a2);
+            PC += sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_SEEN:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            fprintf(f, "0x%04X    SEEN #%u\n", PC-1, a2);
+            PC += sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_PROBE:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            fprintf(f, "0x%04X    PROBE #%u\n", PC-1, a2);
+            PC += sizeof(uint32_t);
+            break;
+        case QUOSI_INSTR_CALLM: {
+            uint32_t n;
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            memcpy(&n, code + PC + sizeof(uint32_t), sizeof(uint32_t));
+            fprintf(f, "0x%04X    CALLM #%u [ ", PC-1, a2);
+            PC += 2 * sizeof(uint32_t);
+            for (uint32_t i = 0; i < n; i++) {
+                memcpy(&a2, code + PC, sizeof(uint32_t));
+                fprintf(f, ".L%u", jumps_get(jumps, njs, a2));
+                if (i < n - 1) fprintf(f, ", ");
+                PC += sizeof(uint32_t);
+            }
+            fprintf(f, " ]\n");
+            break; }
+        case QUOSI_INSTR_RETX:
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            fprintf(f, "0x%04X    RETX #%u\n", PC-1, a2);
             PC += sizeof(uint32_t);
             break;
+        case QUOSI_INSTR_RAND: {
+            uint32_t col[3];
+            memcpy(&a2, code + PC, sizeof(uint32_t));
+            fprintf(f, "0x%04X    RAND [ ", PC-1);
+            PC += sizeof(uint32_t);
+            for (uint32_t i = 0; i < a2; i++) {
+                memcpy(col, code + PC, sizeof(col));
+                fprintf(f, "%.3f .L%u|.L%u", (double)col[0] / 4294967296.0, jumps_get(jumps, njs, col[1]), jumps_get(jumps, njs, col[2]));
+                if (i < a2 - 1) fprintf(f, ", ");
+                PC += sizeof(col);
+            }
+            fprintf(f, " ]\n");
+            break; }
         }
     }
 }
@@ -33,6 +33,15 @@ int quosi_internal_error_check(quosiError* errs, quosiToken tok, int expect, int
     return 0;
 }
 
+int quosi_internal_error_at(quosiError* errs, const char* src, quosiStrView at, int type) {
+    // the same row and column the lexer gave the token
+    quosiToken tok = { .value=at, .span={ 1, 0 } };
+    for (const char* c = src; c <= at.ptr; c++) {
+        if (*c == '\n') { tok.span.row++; tok.span.col = 0; } else { tok.span.col++; }
+    }
+    return quosi_internal_error_handle(errs, tok, type);
+}
+
 
 const char* quosi_error_to_string(quosiErrorValue e) {
     switch (e.type) {
@@ -87,6 +96,34 @@ const char* quosi_error_to_string(quosiErrorValue e) {
         return "opening angle brackets must be closed here";
     case QUOSI_ERR_UNCLOSED_CONDITIONAL:
         return "conditional was opened with no corresponding 'end' label";
+    case QUOSI_ERR_INVALID_WEIGHT:
+        return "'random' arm weight must be a number";
+    case QUOSI_ERR_TOO_MANY_COUNTERS:
+        return "more nodes are tested with 'visits' or 'once' than the vm keeps counters for";
+    case QUOSI_ERR_UNKNOWN_FUNCTION:
+        return "called function is not known to the host";
+    case QUOSI_ERR_TOO_MANY_ARGUMENTS:
+        return "function call cannot take more than 255 arguments";
+    case QUOSI_ERR_BAD_CONSTANT:
+        return "'const' or 'enum' declaration is malformed";
+    case QUOSI_ERR_DUPLICATE_CONSTANT:
+        return "cannot have duplicate constant name";
+    case QUOSI_ERR_UNKNOWN_MODULE:
+        return "imported module does not exist";
+    case QUOSI_ERR_BAD_IMPORT:
+        return "import must bind exactly one vertex per exit parameter of the module";
+    case QUOSI_ERR_INVALID_UTF8:
+        return "string literal is not valid UTF-8";
+    case QUOSI_ERR_UNREACHABLE_VERTEX:
+        return "node can never be reached from 'START' and is left out";
+    case QUOSI_ERR_TOO_MANY_EDGES:
+        return "choice cannot offer more than 65536 options";
+    case QUOSI_ERR_ASSIGN_PINNED:
+        return "cannot assign a key the host has pinned";
+    case QUOSI_ERR_STACK_OVERFLOW:
+        return "expression holds more values at once than the vm stack";
+    case QUOSI_ERR_LINE_ID_COLLISION:
+        return "line shares its ID with another line, rename either vertex";
 
     default:
         return "INTERNAL PROGRAMMING ERROR - NON-EXHAUSTIVE SWITCH CASE";
@@ -144,9 +181,41 @@ bool quosi_error_is_critical(quosiErrorValue e) {
         return true;
     case QUOSI_ERR_UNCLOSED_CONDITIONAL:
         return true;
+    case QUOSI_ERR_INVALID_WEIGHT:
+        return true;
+    case QUOSI_ERR_TOO_MANY_COUNTERS:
+        return false;
+    case QUOSI_ERR_UNKNOWN_FUNCTION:
+        return false;
+    case QUOSI_ERR_TOO_MANY_ARGUMENTS:
+        return false;
+    case QUOSI_ERR_BAD_CONSTANT:
+        return true;
+    case QUOSI_ERR_DUPLICATE_CONSTANT:
+        return false;
+    case QUOSI_ERR_UNKNOWN_MODULE:
+        return false;
+    case QUOSI_ERR_BAD_IMPORT:
+        return false;
+    case QUOSI_ERR_INVALID_UTF8:
+        return false;
+    case QUOSI_ERR_UNREACHABLE_VERTEX:
+        return false;
+    case QUOSI_ERR_TOO_MANY_EDGES:
+        return false;
+    case QUOSI_ERR_ASSIGN_PINNED:
+        return false;
+    case QUOSI_ERR_STACK_OVERFLOW:
+        return false;
+    case QUOSI_ERR_LINE_ID_COLLISION:
+        return false;
 
     default:
         return true;
     }
 }
 
+bool quosi_error_is_warning(quosiErrorValue e) {
+    return e.type == QUOSI_ERR_UNREACHABLE_VERTEX;
+}
+
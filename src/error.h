@@ -4,6 +4,8 @@
 
 int quosi_internal_error_handle(quosiError* errs, quosiToken tok, int type);
 int quosi_internal_error_check(quosiError* errs, quosiToken tok, int expect, int failtype);
+// for errors found after parsing, at must point into src where the offending token began
+int quosi_internal_error_at(quosiError* errs, const char* src, quosiStrView at, int type);
 
 #define EH_FAIL(tok, E)     do { if (quosi_internal_error_handle(ctx->errors, tok, QUOSI_ERR_##E)) return; } while (0)
 #define EH_CHECK(tok, T, E) do { if (quosi_internal_error_check(ctx->errors, tok, QUOSI_TOKEN_##T, QUOSI_ERR_##E)) return; } while (0)
@@ -7,6 +7,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#define QUOSIDS_ALLOCATOR (ctx->alloc)
+#include "vec.h"
 
 
 struct Assoc { float lhs; float rhs; };
@@ -121,7 +123,65 @@ static void parse_expr_impl(quosiParseCtx* ctx, quosiExpr* result, float minbp,
         result->tag = QUOSI_EXPR_OP;
         break; }
 
-    case QUOSI_TOKEN_IDENT: case QUOSI_TOKEN_KEYWORD: case QUOSI_TOKEN_NUMBER:
+    case QUOSI_TOKEN_KEYWORD:
+        if (STREQ(n.value, "once")) {
+            // once == (visits(<this vertex>) <= 1), the counter is bumped on entry
+            TNEXT(&ctx->tokens);
+            result->lhs = quosi_allocator_allocate(ctx->alloc, sizeof(quosiExpr));
+            result->lhs->value.ident = ctx->vertex;
+            result->lhs->tag = QUOSI_EXPR_VISITS;
+            result->rhs = quosi_allocator_allocate(ctx->alloc, sizeof(quosiExpr));
+            result->rhs->value.imm = (uint64_t)1;
+            result->rhs->tag = QUOSI_EXPR_IMM;
+            result->value.op = QUOSI_INSTR_LEQ;
+            result->tag = QUOSI_EXPR_OP;
+            break;
+        } else if (STREQ(n.value, "visits")) {
+            // visits(IDENT)
+            TNEXT(&ctx->tokens);
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, OPENPAREN, INVALID_ATOM);
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, IDENT, INVALID_ATOM);
+            result->value.ident = n.value;
+            result->tag = QUOSI_EXPR_VISITS;
+            quosids_arrpush(ctx->edges, n);
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, CLOSEPAREN, UNCLOSED_PAREN);
+            break;
+        }
+        quosi_internal_parse_value(ctx, result);
+        EH_PROP();
+        break;
+    case QUOSI_TOKEN_IDENT:
+        TNEXT(&ctx->tokens);
+        if (TPEEK(&ctx->tokens).type != QUOSI_TOKEN_OPENPAREN) {
+            result->value.ident = n.value;
+            result->tag = QUOSI_EXPR_IDENT;
+            break;
+        }
+        // IDENT(EXPR, ...)
+        const quosiToken name = n;
+        TNEXT(&ctx->tokens);
+        result->value.call.name = n.value;
+        result->value.call.args = NULL;
+        result->tag = QUOSI_EXPR_CALL;
+        if (TPEEK(&ctx->tokens).type == QUOSI_TOKEN_CLOSEPAREN) {
+            TNEXT(&ctx->tokens);
+            break;
+        }
+        while (true) {
+            quosiExpr* arg = quosids_arraddnptr(result->value.call.args, 1);
+            parse_expr_impl(ctx, arg, 0, l + 1);
+            EH_PROP();
+            n = TNEXT(&ctx->tokens);
+            if (n.type == QUOSI_TOKEN_CLOSEPAREN) break;
+            EH_CHECK(n, COMMA, UNCLOSED_PAREN);
+        }
+        // CALL carries argc in one byte
+        if (quosids_arrlenu(result->value.call.args) > UINT8_MAX) EH_FAIL(name, TOO_MANY_ARGUMENTS);
+        break;
+    case QUOSI_TOKEN_NUMBER:
         quosi_internal_parse_value(ctx, result);
         EH_PROP();
         break;
@@ -1,13 +1,23 @@
 #include "quosi/quosi.h"
 #include "quosi/ast.h"
 #include "quosi/bc.h"
+#include "quosi/vm.h"
+#include "ir.h"
+#include "error.h"
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #define QUOSIDS_ALLOCATOR (ctx->alloc)
 #include "vec.h"
 
 
 #define STREQ(view, cptr) ((view.len == sizeof(cptr)-1) && (strncmp(view.ptr, cptr, view.len) == 0))
+// matches with at least this many constant arms lower to SWITCH, or a search tree when too sparse
+#define SWITCH_MIN_ARMS 4
+// search tree nodes with this few arms test each one in turn
+#define SEARCH_LEAF_ARMS 3
+// tails shorter than this stay copied into each module, a JUMP to a shared one is not much smaller
+#define SHARED_MIN_BYTES 16
 
 
 typedef struct JumpTarget {
@@ -17,32 +27,120 @@ typedef struct JumpTarget {
 typedef struct StringTarget {
     uint32_t referenced_at;
     quosiStrView value;
+    // operand receiving the segment table, UINT32_MAX if value has no ${...}
+    uint32_t template_at;
 } StringTarget;
 typedef struct EffectTarget {
     const quosiEdge* edge;
     uint32_t label;
 } EffectTarget;
+typedef struct LineEntry {
+    uint32_t id;
+    uint32_t mod;
+    // of the LINE instruction within the module
+    uint32_t at;
+    quosiStrView text;
+} LineEntry;
+typedef struct VertexEntry {
+    uint32_t mod;
+    quosiStrView name;
+    uint32_t at;
+} VertexEntry;
+typedef struct FarJump {
+    uint32_t mod;
+    uint32_t referenced_at;
+    // within the common region
+    uint32_t at;
+} FarJump;
+typedef struct SharedKey {
+    uint32_t hash;
+    uint32_t mod;
+    uint32_t blk;
+} SharedKey;
+typedef struct Symbol {
+    // NULL ptr marks an empty slot
+    quosiStrView name;
+    uint32_t id;
+} Symbol;
+typedef struct SymbolTable {
+    // vector, open addressed, length is a power of two
+    Symbol* slots;
+    uint32_t count;
+} SymbolTable;
+typedef struct CaseArm {
+    uint64_t val;
+    uint32_t label;
+    // source position, the first of duplicate values wins
+    uint32_t order;
+} CaseArm;
+typedef struct AliasColumn {
+    uint32_t prob;
+    uint32_t alias;
+} AliasColumn;
 
 typedef struct GenContext {
     quosiAllocator alloc;
+    quosiError* errors;
+    // source the AST points into, locates errors
+    const char* src;
     quosiSymbolCtx symbol_ctx;
+    quosiCompileOptions opts;
     const quosiGraph* name_lkp;
+    // vector, file scope constants, module scope ones live in name_lkp
+    const quosiConstant* globals;
+    // vector, every module of the file, targets of imports
+    const quosiGraph* modules;
+    // vector, interned across modules, index is the event ID
+    quosiStrView* events;
+    // event ID of each name in events
+    SymbolTable event_ids;
+    // vector, every LINE of the file, sorted into the line table once all modules are compiled
+    LineEntry* lines;
+    // vector, entry point of every vertex of the file, sorted into the vertex table once all modules are compiled
+    VertexEntry* verts;
+    quosiStrView vertex;
+    // values the enclosing code keeps on the vm stack under the expression being compiled
+    uint32_t held;
+    // compile_expr and compile_cond calls in flight, only the outermost checks the stack depth
+    uint32_t expr_nest;
+    uint32_t line_ordinal;
+    uint32_t mod_index;
+    // next PROBE ID, handed out in source order whether or not probes are emitted
+    uint32_t probe_index;
+    // vector, code shared by several modules, laid out behind the code of the last one
+    uint8_t* common;
+    // vector, strings referenced from common
+    StringTarget* common_strings;
+    // vector, jumps into common, patched once the size of every module is known
+    FarJump* far;
 
-    // vector
+    // blocks of the current module, the first #VERTICES + #PARAMS are the edge targets
+    quosiIrFunc fn;
+    // vector, lowered code of the current module
     uint8_t* result;
     // vector
-    uint32_t* labels;
-    // vector
     LabelTarget* jumps;
     // vector
     EffectTarget* edges;
     // vector
     StringTarget* strings;
+    // vector, visit counter of each vertex, UINT32_MAX if never tested
+    uint32_t* counters;
+    // vector, offset in common of each block of the current module, UINT32_MAX if it has no copy there
+    uint32_t* shared;
+    // vector, PROBE ID of each vertex of the current module, UINT32_MAX if left out
+    uint32_t* vprobes;
 
     uint32_t edge_index;
     uint32_t symbol_index;
+    uint32_t counter_index;
 
-    // std::pmr::unordered_map<std::string_view, uint32_t> symbols;
+    // host lookups already made this compile, each distinct name is resolved once
+    SymbolTable flags;
+    SymbolTable speakers;
+    SymbolTable funcs;
+    // vector, NUL terminated copy of the name being handed to the host
+    char* scratch;
 } GenContext;
 
 void quosi_program_data_free(quosiProgramData* data, quosiAllocator alloc) {
@@ -54,125 +152,384 @@ void quosi_program_data_free(quosiProgramData* data, quosiAllocator alloc) {
         quosids_arrfree(data->mods[i].code);
     }
     quosids_arrfree(data->mods);
+    quosids_arrfree(data->common);
     quosids_arrfree(data->strs);
+    quosids_arrfree(data->tmpl);
+    quosids_arrfree(data->evts);
+    quosids_arrfree(data->lines);
+    quosids_arrfree(data->verts);
     quosids_arrfree(data->syms);
 }
 
 static uint32_t gen_label(GenContext* ctx) {
-    const uint32_t l = (uint32_t)quosids_arrlenu(ctx->labels);
-    quosids_arraddn(ctx->labels, 1);
-    return l;
+    return quosi_ir_block(&ctx->fn);
+}
+static void emit_op(GenContext* ctx, uint8_t op) {
+    quosi_ir_emit(&ctx->fn, (quosiIrInstr){ .op=op });
+}
+static void emit_u32(GenContext* ctx, uint8_t op, uint32_t a) {
+    quosi_ir_emit(&ctx->fn, (quosiIrInstr){ .op=op, .a=a });
+}
+static void emit_imm(GenContext* ctx, uint8_t op, uint64_t imm) {
+    quosi_ir_emit(&ctx->fn, (quosiIrInstr){ .op=op, .imm=imm });
+}
+static uint32_t probe_count(GenContext* ctx, uint32_t id) {
+    return (ctx->opts.profile != NULL && id < ctx->opts.profile_len) ? ctx->opts.profile[id] : 0;
+}
+static void emit_probe(GenContext* ctx, uint32_t id) {
+    if (ctx->opts.probes) emit_u32(ctx, QUOSI_INSTR_PROBE, id);
+}
+static void gen_error(GenContext* ctx, quosiStrView at, int type) {
+    quosi_internal_error_at(ctx->errors, ctx->src, at, type);
 }
 static uint32_t resolve_edge(GenContext* ctx, quosiStrView edge) {
     if (STREQ(edge, "EXIT")) {
         return UINT32_MAX;
     }
-    for (size_t i = 0; i < quosids_arrlenu(ctx->name_lkp->vertices); i++) {
-        if ((ctx->name_lkp->vertices[i].name.len == edge.len) &&
-            (strncmp(ctx->name_lkp->vertices[i].name.ptr, edge.ptr, edge.len) == 0))
-        {
+    // the parser rejects dangling edges, a miss never reaches here
+    const uint32_t label = quosi_graph_find(ctx->name_lkp, edge);
+    return (label == UINT32_MAX) ? 0 : label;
+}
+static uint32_t resolve_module(GenContext* ctx, quosiStrView name) {
+    for (size_t i = 0; i < quosids_arrlenu(ctx->modules); i++) {
+        if ((ctx->modules[i].name.len == name.len) && (strncmp(ctx->modules[i].name.ptr, name.ptr, name.len) == 0)) {
             return (uint32_t)i;
         }
     }
-    return 0;
+    return UINT32_MAX;
+}
+static bool constant_lkp(const quosiConstant* consts, quosiStrView sym, uint64_t* value) {
+    for (size_t i = 0; i < quosids_arrlenu(consts); i++) {
+        const quosiConstant* c = &consts[i];
+        if (c->scope.len == 0) {
+            if (c->name.len != sym.len || strncmp(c->name.ptr, sym.ptr, sym.len) != 0) continue;
+        } else {
+            // SCOPE.NAME
+            if (c->scope.len + 1 + c->name.len != sym.len) continue;
+            if (strncmp(c->scope.ptr, sym.ptr, c->scope.len) != 0 || sym.ptr[c->scope.len] != '.') continue;
+            if (strncmp(c->name.ptr, sym.ptr + c->scope.len + 1, c->name.len) != 0) continue;
+        }
+        *value = c->value;
+        return true;
+    }
+    return false;
+}
+static bool resolve_const(GenContext* ctx, quosiStrView sym, uint64_t* value) {
+    return constant_lkp(ctx->name_lkp->constants, sym, value) || constant_lkp(ctx->globals, sym, value);
+}
+static bool expr_const(GenContext* ctx, const quosiExpr* e, uint64_t* value) {
+    if (e->tag == QUOSI_EXPR_IMM) {
+        *value = e->value.imm;
+        return true;
+    }
+    return (e->tag == QUOSI_EXPR_IDENT) && resolve_const(ctx, e->value.ident, value);
+}
+static Symbol* symbol_slot(Symbol* slots, quosiStrView sym) {
+    const size_t mask = quosids_arrlenu(slots) - 1;
+    for (size_t h = quosi_name_hash(sym) & mask;; h = (h + 1) & mask) {
+        const quosiStrView v = slots[h].name;
+        if (v.ptr == NULL || (v.len == sym.len && strncmp(v.ptr, sym.ptr, sym.len) == 0)) return &slots[h];
+    }
+}
+// slot of sym, or the empty slot it is to be stored in
+static Symbol* symbol_find(GenContext* ctx, SymbolTable* table, quosiStrView sym) {
+    const size_t cap = quosids_arrlenu(table->slots);
+    if (2 * (table->count + 1) > cap) {
+        Symbol* slots = NULL;
+        const size_t ncap = (cap == 0) ? 32 : cap * 2;
+        quosids_arraddn(slots, ncap);
+        memset(slots, 0, ncap * sizeof(Symbol));
+        for (size_t i = 0; i < cap; i++) {
+            if (table->slots[i].name.ptr != NULL) *symbol_slot(slots, table->slots[i].name) = table->slots[i];
+        }
+        quosids_arrfree(table->slots);
+        table->slots = slots;
+    }
+    return symbol_slot(table->slots, sym);
+}
+static uint32_t intern_symbol(GenContext* ctx, SymbolTable* table, quosiStrView sym, uint32_t(*lkp)(const char*)) {
+    Symbol* slot = symbol_find(ctx, table, sym);
+    if (slot->name.ptr != NULL) return slot->id;
+
+    if (ctx->scratch) quosids_header(ctx->scratch)->len = 0;
+    quosids_arraddn(ctx->scratch, sym.len + 1);
+    memcpy(ctx->scratch, sym.ptr, sym.len);
+    ctx->scratch[sym.len] = 0;
+    *slot = (Symbol){ sym, lkp(ctx->scratch) };
+    table->count++;
+    return slot->id;
+}
+// IDs are handed out in order of first use, the event table lists names by ID
+static uint32_t resolve_event(GenContext* ctx, quosiStrView name) {
+    Symbol* slot = symbol_find(ctx, &ctx->event_ids, name);
+    if (slot->name.ptr != NULL) return slot->id;
+    *slot = (Symbol){ name, (uint32_t)quosids_arrlenu(ctx->events) };
+    ctx->event_ids.count++;
+    quosids_arrpush(ctx->events, name);
+    return slot->id;
 }
 static uint32_t resolve_flag(GenContext* ctx, quosiStrView sym) {
-    char* cpy = quosi_allocator_allocate(ctx->alloc, (sym.len+1) * sizeof(char));
-    cpy[sym.len] = 0;
-    memcpy(cpy, sym.ptr, sym.len);
-    return ctx->symbol_ctx.data_lkp(cpy);
+    return intern_symbol(ctx, &ctx->flags, sym, ctx->symbol_ctx.data_lkp);
+}
+static bool resolve_pin(GenContext* ctx, uint32_t key, uint64_t* value) {
+    for (uint32_t i = 0; i < ctx->opts.npins; i++) {
+        if (ctx->opts.pins[i].key == key) {
+            *value = ctx->opts.pins[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+// every read of a pinned key is folded to its value, so a store to it would go unseen
+static uint32_t resolve_store(GenContext* ctx, quosiStrView sym) {
+    const uint32_t key = resolve_flag(ctx, sym);
+    uint64_t unused;
+    if (resolve_pin(ctx, key, &unused)) gen_error(ctx, sym, QUOSI_ERR_ASSIGN_PINNED);
+    return key;
 }
 static uint32_t resolve_speaker(GenContext* ctx, quosiStrView sym) {
-    char* cpy = quosi_allocator_allocate(ctx->alloc, (sym.len+1) * sizeof(char));
-    cpy[sym.len] = 0;
-    memcpy(cpy, sym.ptr, sym.len);
-    return ctx->symbol_ctx.speaker_lkp(cpy);
+    return intern_symbol(ctx, &ctx->speakers, sym, ctx->symbol_ctx.speaker_lkp);
+}
+static uint32_t resolve_func(GenContext* ctx, quosiStrView sym) {
+    if (!ctx->symbol_ctx.func_lkp) return UINT32_MAX;
+    return intern_symbol(ctx, &ctx->funcs, sym, ctx->symbol_ctx.func_lkp);
 }
 
 
+static uint32_t append_string(GenContext* ctx, quosiProgramData* result, quosiStrView str);
+static void push_u32(GenContext* ctx, uint8_t** vec, uint32_t val);
+static bool is_template(quosiStrView str);
+static int line_entry_cmp(const void* a, const void* b);
+static int vertex_entry_cmp(const void* a, const void* b);
+static uint32_t line_hash(GenContext* ctx);
+static uint32_t count_lines(const quosiVertex* v);
+static uint32_t append_template(GenContext* ctx, quosiProgramData* result, uint32_t pos);
 static void compile_edge(GenContext* ctx, const quosiEdge* edge);
 static void compile_vertex(GenContext* ctx, const quosiVertex* vert);
 static void compile_effects(GenContext* ctx, const quosiEffect* effs);
 static void compile_expr(GenContext* ctx, const quosiExpr* expr, bool ieq);
+static void compile_cond(GenContext* ctx, const quosiExpr* expr, bool jump_if, uint32_t target);
 static void compile_eblock(GenContext* ctx, const quosiEdgeBlock* block);
 static void compile_vblock(GenContext* ctx, const quosiVertexBlock* block);
+static AliasColumn* build_alias_table(GenContext* ctx, const quosiVertexRandomArm* arms);
+static void collect_visits_vblock(GenContext* ctx, const quosiVertexBlock* block);
+static int case_arm_cmp(const void* a, const void* b);
+static void compile_search(GenContext* ctx, const CaseArm* cases, size_t n, uint32_t miss);
+static bool compile_cases(GenContext* ctx, const quosiExpr* expr, const uint64_t* vals, const uint32_t* arms, uint32_t miss);
+static bool exclusive_tests(GenContext* ctx, const quosiExpr* const* conds, bool match);
+static uint32_t* arm_order(GenContext* ctx, uint32_t base, uint32_t n);
+static void layout_by_profile(GenContext* ctx);
+static uint32_t* lower_func(GenContext* ctx);
+static uint32_t lower_shared(GenContext* ctx, const quosiIrBlock* blk);
+static uint32_t** share_tails(GenContext* ctx, const quosiIrFunc* funcs);
 
 
-quosiProgramData quosi_compile_ast(const quosiAst* ast, quosiSymbolCtx symbol_ctx, quosiAllocator alloc) {
+quosiProgramData quosi_compile_ast(const quosiAst* ast, quosiSymbolCtx symbol_ctx, const quosiCompileOptions* opts, quosiError* errors, quosiAllocator alloc) {
     GenContext context = (GenContext){
         .alloc=alloc,
+        .errors=errors,
+        .src=ast->src,
         .symbol_ctx=symbol_ctx,
+        .opts=opts ? *opts : (quosiCompileOptions){ .opt_level=QUOSI_OPT_DEFAULT },
+        .globals=ast->constants,
+        .modules=ast->modules,
     };
     GenContext* ctx = &context;
     quosiProgramData result = {0};
+    // a profile moves vertices and reorders tests, which only FULL allows
+    if (ctx->opts.opt_level < QUOSI_OPT_FULL) ctx->opts.profile = NULL;
 
+    // EVERY MODULE IS OPTIMIZED BEFORE ANY IS LOWERED, SO TAILS THEY SHARE ARE KNOWN UP FRONT
+    quosiIrFunc* funcs = NULL;
+    uint32_t* entries = NULL;
     for (size_t i = 0; i < quosids_arrlenu(ast->modules); i++) {
         const quosiGraph* mod = &ast->modules[i];
         ctx->name_lkp = mod;
-        ctx->result = NULL;
-        ctx->labels = NULL;
-        ctx->jumps = NULL;
+        ctx->mod_index = (uint32_t)i;
         ctx->edges = NULL;
-        ctx->strings = NULL;
+        ctx->counters = NULL;
+        ctx->vprobes = NULL;
         ctx->edge_index = 0;
         ctx->symbol_index = 0;
 
-        // FIRST #VERTICES LABELS RESERVED FOR EDGE JUMPS
-        quosids_arraddn(ctx->labels, quosids_arrlenu(mod->vertices));
-        uint32_t entry_pos = UINT32_MAX;
+        // VERTICES START NEVER LEADS TO ARE LEFT OUT ENTIRELY
+        bool* live = NULL;
+        quosids_arraddn(live, quosids_arrlenu(mod->vertices));
+        quosi_graph_reachable(mod, live, alloc);
+
+        // FIRST #VERTICES + #PARAMS BLOCKS RESERVED FOR EDGE JUMPS
+        quosi_ir_init(&ctx->fn, alloc);
+        for (size_t j = 0; j < quosids_arrlenu(mod->vertices) + quosids_arrlenu(mod->params); j++) {
+            const uint32_t blk = gen_label(ctx);
+            ctx->fn.blocks[blk].entry = (j >= quosids_arrlenu(mod->vertices)) || live[j];
+        }
+        uint32_t entry_blk = UINT32_MAX;
+
+        // VISIT COUNTERS, ONLY FOR VERTICES SOME CONDITION ASKS ABOUT
+        quosids_arraddn(ctx->counters, quosids_arrlenu(mod->vertices));
+        memset(ctx->counters, 0xFF, quosids_arrlenu(ctx->counters) * sizeof(uint32_t));
+        quosids_arraddn(ctx->vprobes, quosids_arrlenu(mod->vertices));
+        memset(ctx->vprobes, 0xFF, quosids_arrlenu(ctx->vprobes) * sizeof(uint32_t));
+        for (size_t j = 0; j < quosids_arrlenu(mod->vertices); j++) {
+            if (live[j]) collect_visits_vblock(ctx, &mod->vertices[j].data);
+        }
 
         // CODE GENERATION
         for (size_t j = 0; j < quosids_arrlenu(mod->vertices); j++) {
             const quosiNamedVertex* v = &mod->vertices[j];
-            const uint32_t curr_pos = (uint32_t)quosids_arrlenu(ctx->result);
-            ctx->labels[j] = curr_pos;
-            if (STREQ(v->name, "START")) entry_pos = curr_pos;
+            if (!live[j]) continue;
+            quosi_ir_place(&ctx->fn, (uint32_t)j);
+            if (STREQ(v->name, "START")) entry_blk = (uint32_t)j;
+            ctx->vertex = v->name;
+            ctx->line_ordinal = 0;
+            if (ctx->counters[j] != UINT32_MAX) {
+                emit_u32(ctx, QUOSI_INSTR_VISIT, ctx->counters[j]);
+            }
+            ctx->vprobes[j] = ctx->probe_index++;
+            emit_probe(ctx, ctx->vprobes[j]);
             compile_vblock(ctx, &v->data);
         }
+        // EXIT PARAMETER k RETURNS THROUGH THE k'th TARGET OF THE IMPORTER
+        for (uint32_t k = 0; k < (uint32_t)quosids_arrlenu(mod->params); k++) {
+            quosi_ir_place(&ctx->fn, (uint32_t)quosids_arrlenu(mod->vertices) + k);
+            quosi_ir_term(&ctx->fn, (quosiIrTerm){ .kind=QUOSI_IR_TERM_RETX, .arg=k });
+        }
+
+        // OPTIMIZATION, THEN HOT VERTICES TOGETHER AND COLD ONES LAST
+        quosi_ir_optimize(&ctx->fn, &ctx->opts);
+        if (ctx->opts.profile) layout_by_profile(ctx);
+        quosids_arrpush(funcs, ctx->fn);
+        quosids_arrpush(entries, entry_blk);
+        quosids_arrfree(live);
+        quosids_arrfree(ctx->edges);
+        quosids_arrfree(ctx->counters);
+        quosids_arrfree(ctx->vprobes);
+    }
+    result.nprobes = ctx->opts.probes ? ctx->probe_index : 0;
+    uint32_t** shared = share_tails(ctx, funcs);
+
+    for (size_t i = 0; i < quosids_arrlenu(ast->modules); i++) {
+        const quosiGraph* mod = &ast->modules[i];
+        ctx->name_lkp = mod;
+        ctx->mod_index = (uint32_t)i;
+        ctx->fn = funcs[i];
+        ctx->shared = shared[i];
+        ctx->result = NULL;
+        ctx->jumps = NULL;
+        ctx->strings = NULL;
+
+        // LOWERING, TAILS IN THE COMMON REGION ARE LEFT OUT
+        size_t n = 0;
+        for (size_t j = 0; j < quosids_arrlenu(ctx->fn.layout); j++) {
+            if (ctx->shared[ctx->fn.layout[j]] == UINT32_MAX) ctx->fn.layout[n++] = ctx->fn.layout[j];
+        }
+        if (ctx->fn.layout) quosids_header(ctx->fn.layout)->len = n;
+        uint32_t* offsets = lower_func(ctx);
+        const uint32_t entry_pos = (entries[i] == UINT32_MAX) ? UINT32_MAX : offsets[entries[i]];
+        for (size_t j = 0; j < quosids_arrlenu(mod->vertices); j++) {
+            if (offsets[j] != UINT32_MAX) {
+                quosids_arrpush(ctx->verts, ((VertexEntry){ ctx->mod_index, mod->vertices[j].name, offsets[j] }));
+            }
+        }
 
         // JUMP PATCHING
         for (size_t j = 0; j < quosids_arrlenu(ctx->jumps); j++) {
             const LabelTarget* jmp = &ctx->jumps[j];
-            if (jmp->label == UINT32_MAX) {
-                const uint32_t exit_marker = UINT32_MAX;
-                memcpy(ctx->result + jmp->referenced_at, &exit_marker, sizeof(uint32_t));
-            } else {
-                memcpy(ctx->result + jmp->referenced_at, &ctx->labels[jmp->label], sizeof(uint32_t));
+            if (jmp->label != QUOSI_IR_EXIT && ctx->shared[jmp->label] != UINT32_MAX) {
+                quosids_arrpush(ctx->far, ((FarJump){ ctx->mod_index, jmp->referenced_at, ctx->shared[jmp->label] }));
+                continue;
             }
+            const uint32_t pos = (jmp->label == QUOSI_IR_EXIT) ? UINT32_MAX : offsets[jmp->label];
+            memcpy(ctx->result + jmp->referenced_at, &pos, sizeof(uint32_t));
         }
+        quosids_arrfree(offsets);
 
         // STRING PATCHING
         for (size_t j = 0; j < quosids_arrlenu(ctx->strings); j++) {
             const StringTarget* str = &ctx->strings[j];
-            const uint32_t pos = (uint32_t)quosids_arrlenu(result.strs);
+            const uint32_t pos = append_string(ctx, &result, str->value);
             memcpy(ctx->result + str->referenced_at, &pos, sizeof(uint32_t));
-
-            bool esc = false;
-            for (size_t k = 0; k < str->value.len; k++) {
-                const char c = str->value.ptr[k];
-                if (esc) {
-                    switch (c) {
-                    case 'n':  quosids_arrpush(result.strs, '\n'); break;
-                    case '"':  quosids_arrpush(result.strs, '"');  break;
-                    case '\\': quosids_arrpush(result.strs, '\\'); break;
-                    }
-                    esc = false;
-                } else if (c == '\\') {
-                    esc = true;
-                } else {
-                    quosids_arrpush(result.strs, (uint8_t)c);
-                }
+            if (str->template_at != UINT32_MAX) {
+                const uint32_t tmpl = append_template(ctx, &result, pos);
+                memcpy(ctx->result + str->template_at, &tmpl, sizeof(uint32_t));
             }
-            quosids_arrpush(result.strs, (uint8_t)0);
         }
 
         // DO NOT FREE RESULT -> MUST BE ALIVE AT LOAD TIME
-        quosids_arrfree(ctx->labels);
+        quosi_ir_free(&ctx->fn);
         quosids_arrfree(ctx->jumps);
-        quosids_arrfree(ctx->edges);
         quosids_arrfree(ctx->strings);
+        quosids_arrfree(ctx->shared);
         quosids_arrpush(result.mods, ((quosiModData){ .name=mod->name, .entry=entry_pos, .code=ctx->result }));
     }
+    quosids_arrfree(funcs);
+    quosids_arrfree(entries);
+    quosids_arrfree(shared);
+
+    // COMMON REGION, JUMPS INTO IT ARE RELATIVE TO THE CODE OF THEIR OWN MODULE
+    uint32_t mod_pos = 0;
+    uint32_t* mod_starts = NULL;
+    for (size_t i = 0; i < quosids_arrlenu(result.mods); i++) {
+        quosids_arrpush(mod_starts, mod_pos);
+        mod_pos += (uint32_t)quosids_arrlenu(result.mods[i].code);
+    }
+    for (size_t i = 0; i < quosids_arrlenu(ctx->far); i++) {
+        const FarJump* jmp = &ctx->far[i];
+        const uint32_t pos = mod_pos + jmp->at - mod_starts[jmp->mod];
+        memcpy(result.mods[jmp->mod].code + jmp->referenced_at, &pos, sizeof(uint32_t));
+    }
+    for (size_t i = 0; i < quosids_arrlenu(ctx->common_strings); i++) {
+        const StringTarget* str = &ctx->common_strings[i];
+        const uint32_t pos = append_string(ctx, &result, str->value);
+        memcpy(ctx->common + str->referenced_at, &pos, sizeof(uint32_t));
+        if (str->template_at != UINT32_MAX) {
+            const uint32_t tmpl = append_template(ctx, &result, pos);
+            memcpy(ctx->common + str->template_at, &tmpl, sizeof(uint32_t));
+        }
+    }
+    result.common = ctx->common;
+    quosids_arrfree(mod_starts);
+    quosids_arrfree(ctx->far);
+    quosids_arrfree(ctx->common_strings);
+
+    // LINE TABLE, SORTED BY ID. TWO LINES SHARING AN ID ARE BOTH REPORTED, RENUMBERING EITHER WOULD BREAK THE IDS HOSTS KEEP
+    qsort(ctx->lines, quosids_arrlenu(ctx->lines), sizeof(LineEntry), line_entry_cmp);
+    for (size_t i = 0; i < quosids_arrlenu(ctx->lines); i++) {
+        const LineEntry* e = &ctx->lines[i];
+        const uint8_t* code = result.mods[e->mod].code;
+        if (i > 0 && e->id == ctx->lines[i-1].id) {
+            gen_error(ctx, ctx->lines[i-1].text, QUOSI_ERR_LINE_ID_COLLISION);
+            gen_error(ctx, e->text, QUOSI_ERR_LINE_ID_COLLISION);
+        }
+        uint32_t speaker, str;
+        memcpy(&speaker, code + e->at + 1, sizeof(uint32_t));
+        memcpy(&str, code + e->at + 1 + sizeof(uint32_t), sizeof(uint32_t));
+        push_u32(ctx, &result.lines, e->id);
+        push_u32(ctx, &result.lines, speaker);
+        push_u32(ctx, &result.lines, str);
+    }
+    quosids_arrfree(ctx->lines);
+
+    // VERTEX TABLE, SORTED BY MODULE THEN NAME IN strcmp ORDER
+    qsort(ctx->verts, quosids_arrlenu(ctx->verts), sizeof(VertexEntry), vertex_entry_cmp);
+    for (size_t i = 0; i < quosids_arrlenu(ctx->verts); i++) {
+        const VertexEntry* e = &ctx->verts[i];
+        push_u32(ctx, &result.verts, e->mod);
+        push_u32(ctx, &result.verts, append_string(ctx, &result, e->name));
+        push_u32(ctx, &result.verts, e->at);
+    }
+    quosids_arrfree(ctx->verts);
+
+    // EVENT TABLE, NAMES ARE KEPT FOR DEBUGGING
+    for (size_t i = 0; i < quosids_arrlenu(ctx->events); i++) {
+        push_u32(ctx, &result.evts, append_string(ctx, &result, ctx->events[i]));
+    }
+    quosids_arrfree(ctx->events);
+    quosids_arrfree(ctx->event_ids.slots);
+    quosids_arrfree(ctx->flags.slots);
+    quosids_arrfree(ctx->speakers.slots);
+    quosids_arrfree(ctx->funcs.slots);
+    quosids_arrfree(ctx->scratch);
 
     /* symbol table */
     /*
@@ -191,73 +548,177 @@ quosiProgramData quosi_compile_ast(const quosiAst* ast, quosiSymbolCtx symbol_ct
 }
 
 
+// most values e has on the vm stack at once, mirroring the order compile_expr pushes them in
+static uint32_t expr_depth(const quosiExpr* e) {
+    switch (e->tag) {
+    case QUOSI_EXPR_CALL: {
+        uint32_t depth = 1;
+        for (uint32_t i = 0; i < (uint32_t)quosids_arrlenu(e->value.call.args); i++) {
+            const uint32_t d = i + expr_depth(&e->value.call.args[i]);
+            if (d > depth) depth = d;
+        }
+        return depth; }
+    case QUOSI_EXPR_OP:
+        if (e->value.op == QUOSI_INSTR_LNOT) {
+            return expr_depth(e->lhs);
+        } else if (e->value.op == QUOSI_INSTR_LAND || e->value.op == QUOSI_INSTR_LOR) {
+            // each side is tested and popped before the other runs
+            const uint32_t l = expr_depth(e->lhs);
+            const uint32_t r = expr_depth(e->rhs);
+            return l > r ? l : r;
+        } else if (e->value.op == QUOSI_INSTR_STORE) {
+            return expr_depth(e->rhs) + 1;
+        } else {
+            const uint32_t l = expr_depth(e->lhs);
+            const uint32_t r = 1 + expr_depth(e->rhs);
+            return l > r ? l : r;
+        }
+    default:
+        return 1;
+    }
+}
+// leftmost name in e, false if it has none
+static bool expr_name(const quosiExpr* e, quosiStrView* name) {
+    switch (e->tag) {
+    case QUOSI_EXPR_IDENT:
+    case QUOSI_EXPR_VISITS:
+        *name = e->value.ident;
+        return true;
+    case QUOSI_EXPR_CALL:
+        *name = e->value.call.name;
+        return true;
+    case QUOSI_EXPR_OP:
+        return expr_name(e->lhs, name) || (e->rhs && expr_name(e->rhs, name));
+    default:
+        return false;
+    }
+}
+// the vm aborts once its value stack is full, so a whole expression must fit above what is held under it
+static void check_depth(GenContext* ctx, const quosiExpr* e) {
+    if (ctx->held + expr_depth(e) <= QUOSI_VALUE_STACK_SIZE) return;
+    quosiStrView at = ctx->vertex;
+    expr_name(e, &at);
+    gen_error(ctx, at, QUOSI_ERR_STACK_OVERFLOW);
+}
+
 static void compile_expr(GenContext* ctx, const quosiExpr* e, bool ieq) {
+    if (ctx->expr_nest++ == 0) check_depth(ctx, e);
     switch (e->tag) {
     case QUOSI_EXPR_IDENT: {
-        quosids_arrpush(ctx->result, (uint8_t)(ieq ? QUOSI_INSTR_IEQK : QUOSI_INSTR_LOAD));
-        const uint32_t ref = resolve_flag(ctx, e->value.ident);
-        uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint32_t));
-        memcpy(begin, &ref, sizeof(uint32_t));
+        uint64_t imm;
+        if (resolve_const(ctx, e->value.ident, &imm)) {
+            emit_imm(ctx, ieq ? QUOSI_INSTR_IEQV : QUOSI_INSTR_PUSH, imm);
+            break;
+        }
+        const uint32_t key = resolve_flag(ctx, e->value.ident);
+        if (resolve_pin(ctx, key, &imm)) {
+            emit_imm(ctx, ieq ? QUOSI_INSTR_IEQV : QUOSI_INSTR_PUSH, imm);
+            break;
+        }
+        emit_u32(ctx, ieq ? QUOSI_INSTR_IEQK : QUOSI_INSTR_LOAD, key);
         break; }
-    case QUOSI_EXPR_IMM: {
-        quosids_arrpush(ctx->result, (uint8_t)(ieq ? QUOSI_INSTR_IEQV : QUOSI_INSTR_PUSH));
-        uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint64_t));
-        memcpy(begin, &e->value.imm, sizeof(uint64_t));
+    case QUOSI_EXPR_IMM:
+        emit_imm(ctx, ieq ? QUOSI_INSTR_IEQV : QUOSI_INSTR_PUSH, e->value.imm);
+        break;
+    case QUOSI_EXPR_VISITS: {
+        const uint32_t v = resolve_edge(ctx, e->value.ident);
+        if (v >= quosids_arrlenu(ctx->name_lkp->vertices)) {
+            // EXIT and exit parameters are never entered
+            emit_imm(ctx, ieq ? QUOSI_INSTR_IEQV : QUOSI_INSTR_PUSH, 0);
+        } else {
+            emit_u32(ctx, QUOSI_INSTR_SEEN, ctx->counters[v]);
+        }
+        break; }
+    case QUOSI_EXPR_CALL: {
+        const uint8_t argc = (uint8_t)quosids_arrlenu(e->value.call.args);
+        for (uint8_t i = 0; i < argc; i++) {
+            compile_expr(ctx, &e->value.call.args[i], false);
+        }
+        const uint32_t fn = resolve_func(ctx, e->value.call.name);
+        if (fn == UINT32_MAX) gen_error(ctx, e->value.call.name, QUOSI_ERR_UNKNOWN_FUNCTION);
+        quosi_ir_emit(&ctx->fn, (quosiIrInstr){ .op=QUOSI_INSTR_CALL, .a=fn, .argc=argc });
         break; }
     case QUOSI_EXPR_OP:
         if (e->value.op == QUOSI_INSTR_LNOT) {
             compile_expr(ctx, e->lhs, false);
-            quosids_arrpush(ctx->result, e->value.op);
+            emit_op(ctx, e->value.op);
+        } else if (e->value.op == QUOSI_INSTR_LAND || e->value.op == QUOSI_INSTR_LOR) {
+            // short circuits as a branch, then materializes the outcome
+            const uint32_t false_lbl = gen_label(ctx);
+            const uint32_t end_lbl = gen_label(ctx);
+            compile_cond(ctx, e, false, false_lbl);
+            emit_imm(ctx, QUOSI_INSTR_PUSH, 1);
+            quosi_ir_jump(&ctx->fn, end_lbl);
+            quosi_ir_place(&ctx->fn, false_lbl);
+            emit_imm(ctx, QUOSI_INSTR_PUSH, 0);
+            quosi_ir_place(&ctx->fn, end_lbl);
         } else if (e->value.op == QUOSI_INSTR_STORE) {
             compile_expr(ctx, e->rhs, false);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_DUP);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_STORE);
-            const uint32_t ref = resolve_flag(ctx, e->lhs->value.ident);
-            uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint32_t));
-            memcpy(begin, &ref, sizeof(uint32_t));
+            emit_op(ctx, QUOSI_INSTR_DUP);
+            emit_u32(ctx, QUOSI_INSTR_STORE, resolve_store(ctx, e->lhs->value.ident));
         } else {
             compile_expr(ctx, e->lhs, false);
             compile_expr(ctx, e->rhs, false);
-            quosids_arrpush(ctx->result, e->value.op);
+            emit_op(ctx, e->value.op);
         }
         break;
     }
+    ctx->expr_nest--;
+}
+// jumps to target when expr is truthy == jump_if, else falls through. '&&' and '||' skip
+// their right hand side once the left decides the outcome, so no further LOADs or CALLs run
+static void compile_cond(GenContext* ctx, const quosiExpr* e, bool jump_if, uint32_t target) {
+    if (ctx->expr_nest++ == 0) check_depth(ctx, e);
+    if (e->tag == QUOSI_EXPR_OP && e->value.op == QUOSI_INSTR_LNOT) {
+        compile_cond(ctx, e->lhs, !jump_if, target);
+    } else if (e->tag == QUOSI_EXPR_OP && (e->value.op == QUOSI_INSTR_LAND || e->value.op == QUOSI_INSTR_LOR)) {
+        // the left side alone decides when it is false for '&&' or true for '||'
+        const bool decides = (e->value.op == QUOSI_INSTR_LOR);
+        if (decides == jump_if) {
+            compile_cond(ctx, e->lhs, jump_if, target);
+            compile_cond(ctx, e->rhs, jump_if, target);
+        } else {
+            const uint32_t skip_lbl = gen_label(ctx);
+            compile_cond(ctx, e->lhs, decides, skip_lbl);
+            compile_cond(ctx, e->rhs, jump_if, target);
+            quosi_ir_place(&ctx->fn, skip_lbl);
+        }
+    } else {
+        compile_expr(ctx, e, false);
+        quosi_ir_branch(&ctx->fn, jump_if ? QUOSI_INSTR_JNZ : QUOSI_INSTR_JZ, target);
+    }
+    ctx->expr_nest--;
 }
 static void compile_effects(GenContext* ctx, const quosiEffect* actions) {
     for (size_t i = 0; i < quosids_arrlenu(actions); i++) {
         const quosiEffect* e = &actions[i];
         if (e->op == QUOSI_EFFECT_EVENT) {
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_EVENT);
-            quosids_arrpush(ctx->strings, ((StringTarget){ (uint32_t)quosids_arrlenu(ctx->result), e->lhs }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
+            emit_u32(ctx, QUOSI_INSTR_EVENT, resolve_event(ctx, e->lhs));
         } else {
+            const uint32_t held = ctx->held;
             if (e->op != QUOSI_EFFECT_SET) {
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_LOAD);
-                const uint32_t ref = resolve_flag(ctx, e->lhs);
-                uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint32_t));
-                memcpy(begin, &ref, sizeof(uint32_t));
+                emit_u32(ctx, QUOSI_INSTR_LOAD, resolve_flag(ctx, e->lhs));
+                ctx->held++;
             }
             compile_expr(ctx, &e->rhs, false);
+            ctx->held = held;
             switch (e->op) {
             case QUOSI_EFFECT_ADD:
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_ADD);
+                emit_op(ctx, QUOSI_INSTR_ADD);
                 break;
             case QUOSI_EFFECT_SUB:
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_SUB);
+                emit_op(ctx, QUOSI_INSTR_SUB);
                 break;
             case QUOSI_EFFECT_MUL:
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_MUL);
+                emit_op(ctx, QUOSI_INSTR_MUL);
                 break;
             case QUOSI_EFFECT_DIV:
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_DIV);
+                emit_op(ctx, QUOSI_INSTR_DIV);
                 break;
             default:
                 break;
             }
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_STORE);
-            const uint32_t ref2 = resolve_flag(ctx, e->lhs);
-            uint8_t* begin2 = quosids_arraddnptr(ctx->result, sizeof(uint32_t));
-            memcpy(begin2, &ref2, sizeof(uint32_t));
+            emit_u32(ctx, QUOSI_INSTR_STORE, resolve_store(ctx, e->lhs));
         }
     }
 }
@@ -272,53 +733,145 @@ static void compile_eblock(GenContext* ctx, const quosiEdgeBlock* b) {
     case QUOSI_EBLOCK_MATCH: {
         const quosiEdgeMatch* mc = &b->value.match;
         const uint32_t end_lbl = gen_label(ctx);
+        const uint32_t n = (uint32_t)quosids_arrlenu(mc->arms);
+        uint64_t* vals = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t val;
+            if (!expr_const(ctx, &mc->arms[i].cond, &val)) break;
+            quosids_arrpush(vals, val);
+        }
+        if (quosids_arrlenu(vals) == n && n >= SWITCH_MIN_ARMS) {
+            // anything no arm takes lands on the catchall
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t miss_lbl = gen_label(ctx);
+            const bool kept = compile_cases(ctx, &mc->expr, vals, arms, miss_lbl);
+            ctx->held += kept;
+            quosi_ir_place(&ctx->fn, miss_lbl);
+            if (mc->catchall.exists) {
+                compile_edge(ctx, &mc->catchall.arm);
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_jump(&ctx->fn, end_lbl);
+                quosi_ir_place(&ctx->fn, arms[i]);
+                compile_edge(ctx, &mc->arms[i].body);
+            }
+            quosi_ir_place(&ctx->fn, end_lbl);
+            ctx->held -= kept;
+            if (kept) emit_op(ctx, QUOSI_INSTR_POP);
+            quosids_arrfree(arms);
+            quosids_arrfree(vals);
+            break;
+        }
+        quosids_arrfree(vals);
+        const quosiExpr** conds = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(conds, &mc->arms[i].cond);
+        }
+        const bool exclusive = exclusive_tests(ctx, conds, true);
+        quosids_arrfree(conds);
+        const uint32_t base = ctx->probe_index;
+        if (exclusive) ctx->probe_index += n;
         compile_expr(ctx, &mc->expr, false);
-        for (size_t i = 0; i < quosids_arrlenu(mc->arms); i++) {
-            const uint32_t next_lbl = gen_label(ctx);
-            compile_expr(ctx, &mc->arms[i].cond, true);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JZ);
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), next_lbl }));
-
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
-            compile_edge(ctx, &mc->arms[i].body);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JUMP);
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), end_lbl }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
-            ctx->labels[next_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
+        // the scrutinee stays under every arm test and edge until the match ends
+        ctx->held++;
+        if (exclusive && ctx->opts.profile) {
+            // most taken arm tested first, edges still compiled in source order
+            uint32_t* order = arm_order(ctx, base, n);
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t miss_lbl = gen_label(ctx);
+            for (uint32_t k = 0; k < n; k++) {
+                compile_expr(ctx, &mc->arms[order[k]].cond, true);
+                quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JNZ, arms[order[k]]);
+            }
+            quosi_ir_jump(&ctx->fn, miss_lbl);
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_place(&ctx->fn, arms[i]);
+                emit_probe(ctx, base + i);
+                compile_edge(ctx, &mc->arms[i].body);
+                quosi_ir_jump(&ctx->fn, end_lbl);
+            }
+            quosi_ir_place(&ctx->fn, miss_lbl);
+            quosids_arrfree(order);
+            quosids_arrfree(arms);
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                const uint32_t next_lbl = gen_label(ctx);
+                compile_expr(ctx, &mc->arms[i].cond, true);
+                quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JZ, next_lbl);
+                if (exclusive) emit_probe(ctx, base + i);
+                compile_edge(ctx, &mc->arms[i].body);
+                quosi_ir_jump(&ctx->fn, end_lbl);
+                quosi_ir_place(&ctx->fn, next_lbl);
+            }
         }
         if (mc->catchall.exists) {
             compile_edge(ctx, &mc->catchall.arm);
         }
-        ctx->labels[end_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
-        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_POP);
+        quosi_ir_place(&ctx->fn, end_lbl);
+        ctx->held--;
+        emit_op(ctx, QUOSI_INSTR_POP);
         break; }
     case QUOSI_EBLOCK_IFELSE: {
         const quosiEdgeIfElse* ie = &b->value.ifelse;
         const uint32_t end_lbl = gen_label(ctx);
-        size_t idx = 0;
-        for (size_t i = 0; i < quosids_arrlenu(ie->blocks); i++) {
-            const uint32_t next_lbl = gen_label(ctx);
-            compile_expr(ctx, &ie->blocks[i].cond, false);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JZ);
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), next_lbl }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
-            for (size_t j = 0; j < quosids_arrlenu(ie->blocks[i].body); j++) {
-                compile_eblock(ctx, &ie->blocks[i].body[j]);
+        const uint32_t n = (uint32_t)quosids_arrlenu(ie->blocks);
+        const quosiExpr** conds = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(conds, &ie->blocks[i].cond);
+        }
+        const bool exclusive = exclusive_tests(ctx, conds, false);
+        quosids_arrfree(conds);
+        const uint32_t base = ctx->probe_index;
+        if (exclusive) ctx->probe_index += n;
+        if (exclusive && ctx->opts.profile) {
+            // most taken arm tested first, edges still compiled in source order
+            uint32_t* order = arm_order(ctx, base, n);
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t else_lbl = gen_label(ctx);
+            for (uint32_t k = 0; k < n; k++) {
+                compile_cond(ctx, &ie->blocks[order[k]].cond, true, arms[order[k]]);
             }
-            if (ie->catchall != NULL || idx < quosids_arrlenu(ie->blocks) - 1) { // micro-opt for superfluous tail branches
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JUMP);
-                quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), end_lbl }));
-                quosids_arraddn(ctx->result, sizeof(uint32_t));
+            quosi_ir_jump(&ctx->fn, else_lbl);
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_place(&ctx->fn, arms[i]);
+                emit_probe(ctx, base + i);
+                for (size_t j = 0; j < quosids_arrlenu(ie->blocks[i].body); j++) {
+                    compile_eblock(ctx, &ie->blocks[i].body[j]);
+                }
+                quosi_ir_jump(&ctx->fn, end_lbl);
+            }
+            quosi_ir_place(&ctx->fn, else_lbl);
+            quosids_arrfree(order);
+            quosids_arrfree(arms);
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                const uint32_t next_lbl = gen_label(ctx);
+                compile_cond(ctx, &ie->blocks[i].cond, false, next_lbl);
+                if (exclusive) emit_probe(ctx, base + i);
+                for (size_t j = 0; j < quosids_arrlenu(ie->blocks[i].body); j++) {
+                    compile_eblock(ctx, &ie->blocks[i].body[j]);
+                }
+                if (ie->catchall != NULL || i < n - 1) { // micro-opt for superfluous tail branches
+                    quosi_ir_jump(&ctx->fn, end_lbl);
+                }
+                quosi_ir_place(&ctx->fn, next_lbl);
             }
-            ctx->labels[next_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
-            idx++;
         }
         if (ie->catchall) {
             for (size_t i = 0; i < quosids_arrlenu(ie->catchall); i++) {
                 compile_eblock(ctx, &ie->catchall[i]);
             }
         }
-        ctx->labels[end_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
+        quosi_ir_place(&ctx->fn, end_lbl);
         break; }
     }
     // we do not need tail jumps since edges are innately jumps
@@ -330,41 +883,414 @@ static void compile_vblock(GenContext* ctx, const quosiVertexBlock* b) {
         break;
     case QUOSI_VBLOCK_MATCH: {
         const quosiVertexMatch* mc = &b->value.match;
+        const uint32_t n = (uint32_t)quosids_arrlenu(mc->arms);
+        uint64_t* vals = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t val;
+            if (!expr_const(ctx, &mc->arms[i].cond, &val)) break;
+            quosids_arrpush(vals, val);
+        }
+        if (quosids_arrlenu(vals) == n && n >= SWITCH_MIN_ARMS) {
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t miss_lbl = gen_label(ctx);
+            const bool kept = compile_cases(ctx, &mc->expr, vals, arms, miss_lbl);
+            quosi_ir_place(&ctx->fn, miss_lbl);
+            if (kept) emit_op(ctx, QUOSI_INSTR_POP);
+            // the catchall is laid out first but keeps its source order line ordinals
+            const uint32_t first_line = ctx->line_ordinal;
+            for (uint32_t i = 0; i < n; i++) {
+                ctx->line_ordinal += count_lines(&mc->arms[i].body);
+            }
+            compile_vertex(ctx, &mc->catchall);
+            const uint32_t end_line = ctx->line_ordinal;
+            ctx->line_ordinal = first_line;
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_place(&ctx->fn, arms[i]);
+                if (kept) emit_op(ctx, QUOSI_INSTR_POP);
+                compile_vertex(ctx, &mc->arms[i].body);
+            }
+            ctx->line_ordinal = end_line;
+            quosids_arrfree(arms);
+            quosids_arrfree(vals);
+            break;
+        }
+        quosids_arrfree(vals);
+        const quosiExpr** conds = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(conds, &mc->arms[i].cond);
+        }
+        const bool exclusive = exclusive_tests(ctx, conds, true);
+        quosids_arrfree(conds);
+        const uint32_t base = ctx->probe_index;
+        if (exclusive) ctx->probe_index += n;
         compile_expr(ctx, &mc->expr, false);
-        for (size_t i = 0; i < quosids_arrlenu(mc->arms); i++) {
-            const uint32_t next_lbl = gen_label(ctx);
-            compile_expr(ctx, &mc->arms[i].cond, true);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JZ);
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), next_lbl }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_POP);
-            compile_vertex(ctx, &mc->arms[i].body);
-            ctx->labels[next_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
+        if (exclusive && ctx->opts.profile) {
+            // most taken arm tested first, bodies still compiled in source order for their line IDs
+            uint32_t* order = arm_order(ctx, base, n);
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t miss_lbl = gen_label(ctx);
+            for (uint32_t k = 0; k < n; k++) {
+                ctx->held++;
+                compile_expr(ctx, &mc->arms[order[k]].cond, true);
+                ctx->held--;
+                quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JNZ, arms[order[k]]);
+            }
+            quosi_ir_jump(&ctx->fn, miss_lbl);
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_place(&ctx->fn, arms[i]);
+                emit_op(ctx, QUOSI_INSTR_POP);
+                emit_probe(ctx, base + i);
+                compile_vertex(ctx, &mc->arms[i].body);
+            }
+            quosi_ir_place(&ctx->fn, miss_lbl);
+            quosids_arrfree(order);
+            quosids_arrfree(arms);
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                const uint32_t next_lbl = gen_label(ctx);
+                ctx->held++;
+                compile_expr(ctx, &mc->arms[i].cond, true);
+                ctx->held--;
+                quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JZ, next_lbl);
+                emit_op(ctx, QUOSI_INSTR_POP);
+                if (exclusive) emit_probe(ctx, base + i);
+                compile_vertex(ctx, &mc->arms[i].body);
+                quosi_ir_place(&ctx->fn, next_lbl);
+            }
         }
-        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_POP);
+        emit_op(ctx, QUOSI_INSTR_POP);
         compile_vertex(ctx, &mc->catchall);
         break; }
     case QUOSI_VBLOCK_IFELSE: {
         const quosiVertexIfElse* ie = &b->value.ifelse;
-        for (size_t i = 0; i < quosids_arrlenu(ie->blocks); i++) {
-            const uint32_t next_lbl = gen_label(ctx);
-            compile_expr(ctx, &ie->blocks[i].cond, false);
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JZ);
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), next_lbl }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
-            compile_vblock(ctx, ie->blocks[i].data);
-            ctx->labels[next_lbl] = (uint32_t)quosids_arrlenu(ctx->result);
+        const uint32_t n = (uint32_t)quosids_arrlenu(ie->blocks);
+        const quosiExpr** conds = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(conds, &ie->blocks[i].cond);
+        }
+        const bool exclusive = exclusive_tests(ctx, conds, false);
+        quosids_arrfree(conds);
+        const uint32_t base = ctx->probe_index;
+        if (exclusive) ctx->probe_index += n;
+        if (exclusive && ctx->opts.profile) {
+            // most taken arm tested first, bodies still compiled in source order for their line IDs
+            uint32_t* order = arm_order(ctx, base, n);
+            uint32_t* arms = NULL;
+            for (uint32_t i = 0; i < n; i++) {
+                quosids_arrpush(arms, gen_label(ctx));
+            }
+            const uint32_t else_lbl = gen_label(ctx);
+            for (uint32_t k = 0; k < n; k++) {
+                compile_cond(ctx, &ie->blocks[order[k]].cond, true, arms[order[k]]);
+            }
+            quosi_ir_jump(&ctx->fn, else_lbl);
+            for (uint32_t i = 0; i < n; i++) {
+                quosi_ir_place(&ctx->fn, arms[i]);
+                emit_probe(ctx, base + i);
+                compile_vblock(ctx, ie->blocks[i].data);
+            }
+            quosi_ir_place(&ctx->fn, else_lbl);
+            quosids_arrfree(order);
+            quosids_arrfree(arms);
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                const uint32_t next_lbl = gen_label(ctx);
+                compile_cond(ctx, &ie->blocks[i].cond, false, next_lbl);
+                if (exclusive) emit_probe(ctx, base + i);
+                compile_vblock(ctx, ie->blocks[i].data);
+                quosi_ir_place(&ctx->fn, next_lbl);
+            }
         }
         compile_vblock(ctx, ie->catchall);
         break; }
+    case QUOSI_VBLOCK_RANDOM: {
+        const quosiVertexRandom* rd = &b->value.random;
+        const uint32_t n = (uint32_t)quosids_arrlenu(rd->arms);
+        uint32_t* arms = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(arms, gen_label(ctx));
+        }
+        AliasColumn* table = build_alias_table(ctx, rd->arms);
+        quosiIrTerm term = { .kind=QUOSI_IR_TERM_RAND };
+        for (uint32_t i = 0; i < n; i++) {
+            quosids_arrpush(term.probs, table[i].prob);
+            quosids_arrpush(term.targets, arms[i]);
+            quosids_arrpush(term.targets, arms[table[i].alias]);
+        }
+        quosids_arrfree(table);
+        quosi_ir_term(&ctx->fn, term);
+
+        for (uint32_t i = 0; i < n; i++) {
+            quosi_ir_place(&ctx->fn, arms[i]);
+            compile_vertex(ctx, &rd->arms[i].body);
+        }
+        quosids_arrfree(arms);
+        break; }
+    case QUOSI_VBLOCK_IMPORT: {
+        const quosiVertexImport* im = &b->value.import;
+        quosiIrTerm term = { .kind=QUOSI_IR_TERM_CALLM, .arg=resolve_module(ctx, im->module) };
+        for (size_t i = 0; i < quosids_arrlenu(im->exits); i++) {
+            quosids_arrpush(term.targets, resolve_edge(ctx, im->exits[i]));
+        }
+        quosi_ir_term(&ctx->fn, term);
+        break; }
     }
     // we do not need tail jumps since vertices always lead to jumps eventually
 }
+
+// copies str into the string table as [u32 len][bytes]\0 with escapes resolved,
+// returns the offset of the bytes so the table still reads as plain C strings
+static uint32_t append_string(GenContext* ctx, quosiProgramData* result, quosiStrView str) {
+    quosids_arraddn(result->strs, sizeof(uint32_t));
+    const uint32_t pos = (uint32_t)quosids_arrlenu(result->strs);
+    bool esc = false;
+    for (size_t k = 0; k < str.len; k++) {
+        const char c = str.ptr[k];
+        if (esc) {
+            switch (c) {
+            case 'n':  quosids_arrpush(result->strs, '\n'); break;
+            case '"':  quosids_arrpush(result->strs, '"');  break;
+            case '\\': quosids_arrpush(result->strs, '\\'); break;
+            }
+            esc = false;
+        } else if (c == '\\') {
+            esc = true;
+        } else {
+            quosids_arrpush(result->strs, (uint8_t)c);
+        }
+    }
+    const uint32_t len = (uint32_t)quosids_arrlenu(result->strs) - pos;
+    memcpy(result->strs + pos - sizeof(uint32_t), &len, sizeof(uint32_t));
+    quosids_arrpush(result->strs, (uint8_t)0);
+    return pos;
+}
+static int line_entry_cmp(const void* _a, const void* _b) {
+    const LineEntry* a = (const LineEntry*)_a;
+    const LineEntry* b = (const LineEntry*)_b;
+    // ties broken by position so collisions are reported the same way every compile
+    if (a->id  != b->id)  return (a->id  < b->id)  ? -1 : 1;
+    if (a->mod != b->mod) return (a->mod < b->mod) ? -1 : 1;
+    if (a->at  != b->at)  return (a->at  < b->at)  ? -1 : 1;
+    return 0;
+}
+static int vertex_entry_cmp(const void* _a, const void* _b) {
+    const VertexEntry* a = (const VertexEntry*)_a;
+    const VertexEntry* b = (const VertexEntry*)_b;
+    if (a->mod != b->mod) return (a->mod < b->mod) ? -1 : 1;
+    const size_t n = a->name.len < b->name.len ? a->name.len : b->name.len;
+    const int c = memcmp(a->name.ptr, b->name.ptr, n);
+    if (c != 0) return c;
+    if (a->name.len != b->name.len) return (a->name.len < b->name.len) ? -1 : 1;
+    return 0;
+}
+// FNV-1a over module, vertex and the source order ordinal of the line within its vertex,
+// so editing one line never moves the ID of a line in another vertex
+static uint32_t line_hash(GenContext* ctx) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < ctx->name_lkp->name.len; i++) {
+        h = (h ^ (uint8_t)ctx->name_lkp->name.ptr[i]) * 16777619u;
+    }
+    h = (h ^ 0) * 16777619u;
+    for (size_t i = 0; i < ctx->vertex.len; i++) {
+        h = (h ^ (uint8_t)ctx->vertex.ptr[i]) * 16777619u;
+    }
+    h = (h ^ 0) * 16777619u;
+    const uint32_t ord = ctx->line_ordinal++;
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+        h = (h ^ ((ord >> (8 * i)) & 0xFF)) * 16777619u;
+    }
+    return h;
+}
+static uint32_t count_lines(const quosiVertex* v) {
+    uint32_t n = 0;
+    for (size_t i = 0; i < quosids_arrlenu(v->lineset); i++) {
+        n += (uint32_t)quosids_arrlenu(v->lineset[i].lines);
+    }
+    return n;
+}
+
+// a string is a template if it contains at least one closed ${...}
+static bool is_template(quosiStrView str) {
+    for (size_t i = 0; i + 1 < str.len; i++) {
+        if (str.ptr[i] == '$' && str.ptr[i+1] == '{' && memchr(str.ptr + i + 2, '}', str.len - i - 2) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+static void push_u32(GenContext* ctx, uint8_t** vec, uint32_t val) {
+    uint8_t* begin = quosids_arraddnptr(*vec, sizeof(uint32_t));
+    memcpy(begin, &val, sizeof(uint32_t));
+}
+// splits the patched string at strs+pos into literal runs and ${key} lookups,
+// offsets are relative to the string so the text itself is stored only once
+static uint32_t append_template(GenContext* ctx, quosiProgramData* result, uint32_t pos) {
+    const uint32_t tmpl = (uint32_t)quosids_arrlenu(result->tmpl);
+    const char* str = (const char*)result->strs + pos;
+    uint32_t len;
+    memcpy(&len, str - sizeof(uint32_t), sizeof(uint32_t));
+    push_u32(ctx, &result->tmpl, pos);
+    push_u32(ctx, &result->tmpl, 0);
+    uint32_t nsegs = 0;
+    uint32_t lit = 0;
+    uint32_t i = 0;
+    while (i < len) {
+        const char* close = (str[i] == '$' && str[i+1] == '{') ? strchr(str + i + 2, '}') : NULL;
+        if (close == NULL) {
+            i++;
+            continue;
+        }
+        if (i > lit) {
+            push_u32(ctx, &result->tmpl, UINT32_MAX);
+            push_u32(ctx, &result->tmpl, lit);
+            push_u32(ctx, &result->tmpl, i - lit);
+            nsegs++;
+        }
+        const uint32_t klen = (uint32_t)(close - (str + i + 2));
+        push_u32(ctx, &result->tmpl, resolve_flag(ctx, (quosiStrView){ str + i + 2, klen }));
+        push_u32(ctx, &result->tmpl, i + 2);
+        push_u32(ctx, &result->tmpl, klen);
+        nsegs++;
+        i = lit = i + 2 + klen + 1;
+    }
+    if (len > lit) {
+        push_u32(ctx, &result->tmpl, UINT32_MAX);
+        push_u32(ctx, &result->tmpl, lit);
+        push_u32(ctx, &result->tmpl, len - lit);
+        nsegs++;
+    }
+    memcpy(result->tmpl + tmpl + sizeof(uint32_t), &nsegs, sizeof(uint32_t));
+    return tmpl;
+}
+
+// true if vals holds enough distinct values to fill [min, min+n) exactly
+static int case_arm_cmp(const void* _a, const void* _b) {
+    const CaseArm* a = (const CaseArm*)_a;
+    const CaseArm* b = (const CaseArm*)_b;
+    if (a->val != b->val) return (a->val < b->val) ? -1 : 1;
+    return (a->order < b->order) ? -1 : (a->order > b->order);
+}
+// expects the scrutinee on the stack, halves the sorted arms with one compare per level
+static void compile_search(GenContext* ctx, const CaseArm* cases, size_t n, uint32_t miss) {
+    if (n <= SEARCH_LEAF_ARMS) {
+        for (size_t i = 0; i < n; i++) {
+            emit_imm(ctx, QUOSI_INSTR_IEQV, cases[i].val);
+            quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JNZ, cases[i].label);
+        }
+        quosi_ir_jump(&ctx->fn, miss);
+        return;
+    }
+    const size_t mid = n / 2;
+    const uint32_t upper_lbl = gen_label(ctx);
+    emit_op(ctx, QUOSI_INSTR_DUP);
+    emit_imm(ctx, QUOSI_INSTR_PUSH, cases[mid].val);
+    emit_op(ctx, QUOSI_INSTR_GEQ);
+    quosi_ir_branch(&ctx->fn, QUOSI_INSTR_JNZ, upper_lbl);
+    compile_search(ctx, cases, mid, miss);
+    quosi_ir_place(&ctx->fn, upper_lbl);
+    compile_search(ctx, cases + mid, n - mid, miss);
+}
+// jumps to arms[i] when expr == vals[i], else to miss. arm values spanning at most twice
+// their count index a SWITCH table whose holes lead to miss, sparser ones get a search tree.
+// true if the scrutinee is left on the stack, which only the search tree does
+static bool compile_cases(GenContext* ctx, const quosiExpr* expr, const uint64_t* vals, const uint32_t* arms, uint32_t miss) {
+    CaseArm* cases = NULL;
+    for (uint32_t i = 0; i < (uint32_t)quosids_arrlenu(vals); i++) {
+        quosids_arrpush(cases, ((CaseArm){ vals[i], arms[i], i }));
+    }
+    qsort(cases, quosids_arrlenu(cases), sizeof(CaseArm), case_arm_cmp);
+    size_t n = 0;
+    for (size_t i = 0; i < quosids_arrlenu(cases); i++) {
+        if (n == 0 || cases[n-1].val != cases[i].val) cases[n++] = cases[i];
+    }
+    quosids_header(cases)->len = n;
+
+    const uint64_t min = cases[0].val;
+    const uint64_t span = cases[n-1].val - min;
+    bool kept = false;
+    compile_expr(ctx, expr, false);
+    if (span / 2 < n) {
+        // expr - min indexes the table
+        uint32_t* table = NULL;
+        quosids_arraddn(table, span + 1);
+        for (size_t i = 0; i <= span; i++) {
+            table[i] = miss;
+        }
+        for (size_t i = 0; i < n; i++) {
+            table[cases[i].val - min] = cases[i].label;
+        }
+        if (min != 0) {
+            emit_imm(ctx, QUOSI_INSTR_PUSH, min);
+            emit_op(ctx, QUOSI_INSTR_SUB);
+        }
+        quosi_ir_switch(&ctx->fn, table);
+    } else {
+        compile_search(ctx, cases, n, miss);
+        kept = true;
+    }
+    quosids_arrfree(cases);
+    return kept;
+}
+
+// Vose's alias method: column i is taken with probability prob/2^32, else its alias.
+// every column is equally likely, so the vm picks an arm with one draw and one compare
+static AliasColumn* build_alias_table(GenContext* ctx, const quosiVertexRandomArm* arms) {
+    const uint32_t n = (uint32_t)quosids_arrlenu(arms);
+    AliasColumn* result = NULL;
+    double* scaled = NULL;
+    uint32_t* small = NULL;
+    uint32_t* large = NULL;
+    quosids_arraddn(result, n);
+    quosids_arraddn(scaled, n);
+
+    double total = 0.0;
+    for (uint32_t i = 0; i < n; i++) {
+        total += (double)arms[i].weight;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        // all zero weights degrade to a uniform pick
+        scaled[i] = (total > 0.0) ? ((double)arms[i].weight * n / total) : 1.0;
+        if (scaled[i] < 1.0) {
+            quosids_arrpush(small, i);
+        } else {
+            quosids_arrpush(large, i);
+        }
+    }
+    while (quosids_arrlenu(small) > 0 && quosids_arrlenu(large) > 0) {
+        const uint32_t s = small[--quosids_header(small)->len];
+        const uint32_t l = quosids_arrlast(large);
+        result[s] = (AliasColumn){ (uint32_t)(scaled[s] * 4294967296.0), l };
+        scaled[l] -= (1.0 - scaled[s]);
+        if (scaled[l] < 1.0) {
+            quosids_header(large)->len--;
+            quosids_arrpush(small, l);
+        }
+    }
+    // leftovers are full columns, only off by rounding error
+    for (size_t i = 0; i < quosids_arrlenu(small); i++) {
+        result[small[i]] = (AliasColumn){ UINT32_MAX, small[i] };
+    }
+    for (size_t i = 0; i < quosids_arrlenu(large); i++) {
+        result[large[i]] = (AliasColumn){ UINT32_MAX, large[i] };
+    }
+
+    quosids_arrfree(scaled);
+    quosids_arrfree(small);
+    quosids_arrfree(large);
+    return result;
+}
 static void compile_edge(GenContext* ctx, const quosiEdge* e) {
-    quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_PROP);
-    quosids_arrpush(ctx->strings, ((StringTarget){ (uint32_t)quosids_arrlenu(ctx->result), e->line }));
-    quosids_arraddn(ctx->result, sizeof(uint32_t));
-    quosids_arrpush(ctx->result, (uint8_t)ctx->edge_index++);
+    const bool tmpl = is_template(e->line);
+    // PROP carries the index in two bytes, a wrapped one would make PICK answer with the wrong option
+    if (ctx->edge_index > UINT16_MAX) gen_error(ctx, e->line, QUOSI_ERR_TOO_MANY_EDGES);
+    const uint16_t idx = (uint16_t)ctx->edge_index++;
+    quosi_ir_emit(&ctx->fn, (quosiIrInstr){ .op=tmpl ? QUOSI_INSTR_PROPT : QUOSI_INSTR_PROP, .str=e->line, .idx=idx });
     if (e->effects == NULL) {
         quosids_arrpush(ctx->edges, ((EffectTarget){ e, resolve_edge(ctx, e->next) }));
     } else {
@@ -374,13 +1300,13 @@ static void compile_edge(GenContext* ctx, const quosiEdge* e) {
 static void compile_vertex(GenContext* ctx, const quosiVertex* v) {
     for (size_t i = 0; i < quosids_arrlenu(v->lineset); i++) {
         for (size_t j = 0; j < quosids_arrlenu(v->lineset[i].lines); j++) {
-            quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_LINE);
-            const uint32_t id = resolve_speaker(ctx, v->lineset[i].speaker);
-            uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint32_t));
-            memcpy(begin, &id, sizeof(uint32_t));         // speaker ID
-
-            quosids_arrpush(ctx->strings, ((StringTarget){ (uint32_t)(quosids_arrlenu(ctx->result)), v->lineset[i].lines[j] }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t)); // line
+            const bool tmpl = is_template(v->lineset[i].lines[j]);
+            quosi_ir_emit(&ctx->fn, (quosiIrInstr){
+                .op=tmpl ? QUOSI_INSTR_LINET : QUOSI_INSTR_LINE,
+                .a=resolve_speaker(ctx, v->lineset[i].speaker),
+                .b=line_hash(ctx),
+                .str=v->lineset[i].lines[j],
+            });
         }
     }
 
@@ -388,32 +1314,449 @@ static void compile_vertex(GenContext* ctx, const quosiVertex* v) {
         if (v->v.jump.effects) {
             compile_effects(ctx, v->v.jump.effects);
         }
-        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JUMP);
-        quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), resolve_edge(ctx, v->v.jump.next) }));
-        quosids_arraddn(ctx->result, sizeof(uint32_t));
+        quosi_ir_jump(&ctx->fn, resolve_edge(ctx, v->v.jump.next));
     } else {
         ctx->edge_index = 0;
         quosids_arrfree(ctx->edges);
+        const uint32_t pick_lbl = gen_label(ctx);
+        quosi_ir_place(&ctx->fn, pick_lbl);
         for (size_t i = 0; i < quosids_arrlenu(v->v.edges); i++) {
             compile_eblock(ctx, &v->v.edges[i]);
         }
-        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_PICK);
-        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_SWITCH);
+        emit_op(ctx, QUOSI_INSTR_PICK);
+        uint32_t* table = NULL;
         for (size_t i = 0; i < quosids_arrlenu(ctx->edges); i++) {
-            const EffectTarget* e = &ctx->edges[i];
-            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), e->label }));
-            quosids_arraddn(ctx->result, sizeof(uint32_t));
+            quosids_arrpush(table, ctx->edges[i].label);
         }
+        quosi_ir_switch(&ctx->fn, table);
+        // an out of range pick asks again
+        quosi_ir_jump(&ctx->fn, pick_lbl);
         for (size_t i = 0; i < quosids_arrlenu(ctx->edges); i++) {
             const EffectTarget* e = &ctx->edges[i];
             if (e->edge->effects != NULL) {
-                ctx->labels[e->label] = (uint32_t)quosids_arrlenu(ctx->result);
+                quosi_ir_place(&ctx->fn, e->label);
                 compile_effects(ctx, e->edge->effects);
-                quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JUMP);
-                quosids_arrpush(ctx->jumps,  ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), resolve_edge(ctx, e->edge->next) }));
-                quosids_arraddn(ctx->result, sizeof(uint32_t));
+                quosi_ir_jump(&ctx->fn, resolve_edge(ctx, e->edge->next));
             }
         }
     }
 }
 
+
+static void lower_jump(GenContext* ctx, uint8_t op, uint32_t target) {
+    quosids_arrpush(ctx->result, op);
+    quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), target }));
+    quosids_arraddn(ctx->result, sizeof(uint32_t));
+}
+static void lower_instr(GenContext* ctx, const quosiIrInstr* in) {
+    const uint32_t at = (uint32_t)quosids_arrlenu(ctx->result);
+    quosids_arrpush(ctx->result, in->op);
+    switch (in->op) {
+    case QUOSI_INSTR_PUSH: case QUOSI_INSTR_IEQV: {
+        uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint64_t));
+        memcpy(begin, &in->imm, sizeof(uint64_t));
+        break; }
+    case QUOSI_INSTR_LOAD: case QUOSI_INSTR_STORE: case QUOSI_INSTR_IEQK:
+    case QUOSI_INSTR_EVENT: case QUOSI_INSTR_VISIT: case QUOSI_INSTR_SEEN: case QUOSI_INSTR_PROBE:
+        push_u32(ctx, &ctx->result, in->a);
+        break;
+    case QUOSI_INSTR_CALL:
+        push_u32(ctx, &ctx->result, in->a);
+        quosids_arrpush(ctx->result, in->argc);
+        break;
+    case QUOSI_INSTR_TSAVE: case QUOSI_INSTR_TLOAD:
+        quosids_arrpush(ctx->result, (uint8_t)in->a);
+        break;
+    case QUOSI_INSTR_PROP: case QUOSI_INSTR_PROPT: {
+        const bool tmpl = in->op == QUOSI_INSTR_PROPT;
+        quosids_arrpush(ctx->strings, ((StringTarget){ at + 1, in->str, tmpl ? at + 7 : UINT32_MAX }));
+        quosids_arraddn(ctx->result, sizeof(uint32_t));
+        uint8_t* begin = quosids_arraddnptr(ctx->result, sizeof(uint16_t));
+        memcpy(begin, &in->idx, sizeof(uint16_t));
+        if (tmpl) quosids_arraddn(ctx->result, sizeof(uint32_t));
+        break; }
+    case QUOSI_INSTR_LINE: case QUOSI_INSTR_LINET: {
+        const bool tmpl = in->op == QUOSI_INSTR_LINET;
+        quosids_arrpush(ctx->lines, ((LineEntry){ in->b, ctx->mod_index, at, in->str }));
+        push_u32(ctx, &ctx->result, in->a);                         // speaker ID
+        quosids_arrpush(ctx->strings, ((StringTarget){ at + 5, in->str, tmpl ? at + 13 : UINT32_MAX }));
+        quosids_arraddn(ctx->result, sizeof(uint32_t));             // line
+        push_u32(ctx, &ctx->result, in->b);                         // line ID
+        if (tmpl) quosids_arraddn(ctx->result, sizeof(uint32_t));   // segment table
+        break; }
+    default:
+        break;
+    }
+}
+// next is the block laid out after this one, jumps to it are left out
+static void lower_term(GenContext* ctx, const quosiIrTerm* t, uint32_t next) {
+    switch (t->kind) {
+    case QUOSI_IR_TERM_NONE:
+        break;
+    case QUOSI_IR_TERM_JUMP:
+        if (t->target != next || t->target == QUOSI_IR_EXIT) {
+            lower_jump(ctx, QUOSI_INSTR_JUMP, t->target);
+        }
+        break;
+    case QUOSI_IR_TERM_BRANCH:
+        if (t->next == next) {
+            lower_jump(ctx, t->op, t->target);
+        } else if (t->target == next && t->target != QUOSI_IR_EXIT) {
+            lower_jump(ctx, (t->op == QUOSI_INSTR_JZ) ? QUOSI_INSTR_JNZ : QUOSI_INSTR_JZ, t->next);
+        } else {
+            lower_jump(ctx, t->op, t->target);
+            lower_jump(ctx, QUOSI_INSTR_JUMP, t->next);
+        }
+        break;
+    case QUOSI_IR_TERM_SWITCH:
+        // SWITCH n, [target] * n
+        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_SWITCH);
+        push_u32(ctx, &ctx->result, (uint32_t)quosids_arrlenu(t->targets));
+        for (size_t i = 0; i < quosids_arrlenu(t->targets); i++) {
+            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), t->targets[i] }));
+            quosids_arraddn(ctx->result, sizeof(uint32_t));
+        }
+        if (t->next != next) {
+            lower_jump(ctx, QUOSI_INSTR_JUMP, t->next);
+        }
+        break;
+    case QUOSI_IR_TERM_RAND:
+        // RAND n, [prob, target, alias] * n
+        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_RAND);
+        push_u32(ctx, &ctx->result, (uint32_t)quosids_arrlenu(t->probs));
+        for (size_t i = 0; i < quosids_arrlenu(t->probs); i++) {
+            push_u32(ctx, &ctx->result, t->probs[i]);
+            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), t->targets[2*i] }));
+            quosids_arraddn(ctx->result, sizeof(uint32_t));
+            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), t->targets[2*i+1] }));
+            quosids_arraddn(ctx->result, sizeof(uint32_t));
+        }
+        break;
+    case QUOSI_IR_TERM_CALLM:
+        // CALLM mod, n, [target] * n
+        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_CALLM);
+        push_u32(ctx, &ctx->result, t->arg);
+        push_u32(ctx, &ctx->result, (uint32_t)quosids_arrlenu(t->targets));
+        for (size_t i = 0; i < quosids_arrlenu(t->targets); i++) {
+            quosids_arrpush(ctx->jumps, ((LabelTarget){ (uint32_t)quosids_arrlenu(ctx->result), t->targets[i] }));
+            quosids_arraddn(ctx->result, sizeof(uint32_t));
+        }
+        break;
+    case QUOSI_IR_TERM_RETX:
+        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_RETX);
+        push_u32(ctx, &ctx->result, t->arg);
+        break;
+    }
+}
+// conditions of which at most one can hold, so the order they are tested in is free. match arms
+// need distinct constants, if arms need 'flag == constant' on the same flag with distinct constants
+static bool exclusive_tests(GenContext* ctx, const quosiExpr* const* conds, bool match) {
+    const size_t n = quosids_arrlenu(conds);
+    uint64_t* vals = NULL;
+    quosiStrView flag = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        const quosiExpr* e = conds[i];
+        uint64_t val, unused;
+        if (!match) {
+            if (e->tag != QUOSI_EXPR_OP || e->value.op != QUOSI_INSTR_EQU) break;
+            const quosiExpr* var;
+            if (expr_const(ctx, e->rhs, &val))      var = e->lhs;
+            else if (expr_const(ctx, e->lhs, &val)) var = e->rhs;
+            else break;
+            if (var->tag != QUOSI_EXPR_IDENT || expr_const(ctx, var, &unused)) break;
+            if (i > 0 && (var->value.ident.len != flag.len || strncmp(var->value.ident.ptr, flag.ptr, flag.len) != 0)) break;
+            flag = var->value.ident;
+        } else if (!expr_const(ctx, e, &val)) {
+            break;
+        }
+        bool seen = false;
+        for (size_t j = 0; j < quosids_arrlenu(vals); j++) seen |= (vals[j] == val);
+        if (seen) break;
+        quosids_arrpush(vals, val);
+    }
+    const bool exclusive = n > 1 && quosids_arrlenu(vals) == n;
+    quosids_arrfree(vals);
+    return exclusive;
+}
+// arm indices most taken first by the profile, ties keep source order
+static uint32_t* arm_order(GenContext* ctx, uint32_t base, uint32_t n) {
+    uint32_t* order = NULL;
+    for (uint32_t i = 0; i < n; i++) {
+        quosids_arrpush(order, i);
+        uint32_t j = i;
+        while (j > 0 && probe_count(ctx, base + order[j-1]) < probe_count(ctx, base + i)) {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = i;
+    }
+    return order;
+}
+// the block is laid out right behind from, or lowering would have to jump to it
+static bool falls_into(const quosiIrBlock* from, uint32_t blk) {
+    const quosiIrTerm* t = &from->term;
+    switch (t->kind) {
+    case QUOSI_IR_TERM_JUMP:   return t->target == blk;
+    case QUOSI_IR_TERM_BRANCH:
+    case QUOSI_IR_TERM_SWITCH: return t->next == blk;
+    default:                   return false;
+    }
+}
+// an entry block and the blocks behind it up to the next entry form a unit, and units falling into one
+// another a chain. chains move hottest vertex first, chains whose vertices never ran keep their order last
+static void layout_by_profile(GenContext* ctx) {
+    quosiIrFunc* fn = &ctx->fn;
+    const size_t n = quosids_arrlenu(fn->layout);
+    uint32_t* starts = NULL;
+    uint32_t* heat = NULL;
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t b = fn->layout[i];
+        if (i == 0 || (fn->blocks[b].entry && !falls_into(&fn->blocks[fn->layout[i-1]], b))) {
+            quosids_arrpush(starts, (uint32_t)i);
+            quosids_arrpush(heat, 0);
+        }
+        if (b < quosids_arrlenu(ctx->vprobes) && ctx->vprobes[b] != UINT32_MAX) {
+            const uint32_t count = probe_count(ctx, ctx->vprobes[b]);
+            uint32_t* h = &heat[quosids_arrlenu(heat) - 1];
+            if (count > *h) *h = count;
+        }
+    }
+    const uint32_t nchains = (uint32_t)quosids_arrlenu(starts);
+    quosids_arrpush(starts, (uint32_t)n);
+
+    // insertion sort, stable so cold chains stay in source order
+    uint32_t* chains = NULL;
+    for (uint32_t c = 0; c < nchains; c++) {
+        quosids_arrpush(chains, c);
+        uint32_t j = c;
+        while (j > 0 && heat[chains[j-1]] < heat[c]) {
+            chains[j] = chains[j-1];
+            j--;
+        }
+        chains[j] = c;
+    }
+    uint32_t* order = NULL;
+    for (uint32_t c = 0; c < nchains; c++) {
+        for (uint32_t i = starts[chains[c]]; i < starts[chains[c] + 1]; i++) {
+            quosids_arrpush(order, fn->layout[i]);
+        }
+    }
+    quosids_arrfree(fn->layout);
+    fn->layout = order;
+    quosids_arrfree(starts);
+    quosids_arrfree(heat);
+    quosids_arrfree(chains);
+}
+
+// lowers a tail into the common region, where it may only leave the conversation or the module
+static uint32_t lower_shared(GenContext* ctx, const quosiIrBlock* blk) {
+    uint8_t* own_result = ctx->result;
+    StringTarget* own_strings = ctx->strings;
+    ctx->result = ctx->common;
+    ctx->strings = ctx->common_strings;
+    const uint32_t at = (uint32_t)quosids_arrlenu(ctx->result);
+    for (size_t j = 0; j < quosids_arrlenu(blk->code); j++) {
+        lower_instr(ctx, &blk->code[j]);
+    }
+    if (blk->term.kind == QUOSI_IR_TERM_JUMP) {
+        quosids_arrpush(ctx->result, (uint8_t)QUOSI_INSTR_JUMP);
+        push_u32(ctx, &ctx->result, UINT32_MAX);
+    } else {
+        lower_term(ctx, &blk->term, QUOSI_IR_EXIT);
+    }
+    ctx->common = ctx->result;
+    ctx->common_strings = ctx->strings;
+    ctx->result = own_result;
+    ctx->strings = own_strings;
+    return at;
+}
+// position independent tails, no jumps within their module and no line table entries
+static bool shareable(const quosiIrBlock* blk) {
+    const quosiIrTerm* t = &blk->term;
+    if (blk->entry || quosids_arrlenu(blk->code) == 0) return false;
+    if (!(t->kind == QUOSI_IR_TERM_JUMP && t->target == QUOSI_IR_EXIT) && t->kind != QUOSI_IR_TERM_RETX) return false;
+    uint32_t bytes = 1 + sizeof(uint32_t);
+    for (size_t i = 0; i < quosids_arrlenu(blk->code); i++) {
+        const uint8_t op = blk->code[i].op;
+        if (op == QUOSI_INSTR_LINE || op == QUOSI_INSTR_LINET) return false;
+        bytes += quosi_ir_instr_size(&blk->code[i]);
+    }
+    return bytes >= SHARED_MIN_BYTES;
+}
+static bool same_block(const quosiIrBlock* a, const quosiIrBlock* b) {
+    if (quosids_arrlenu(a->code) != quosids_arrlenu(b->code) || !quosi_ir_same_term(&a->term, &b->term)) return false;
+    for (size_t i = 0; i < quosids_arrlenu(a->code); i++) {
+        if (!quosi_ir_same_instr(&a->code[i], &b->code[i])) return false;
+    }
+    return true;
+}
+static int shared_key_cmp(const void* _a, const void* _b) {
+    const SharedKey* a = (const SharedKey*)_a;
+    const SharedKey* b = (const SharedKey*)_b;
+    if (a->hash != b->hash) return (a->hash < b->hash) ? -1 : 1;
+    if (a->mod != b->mod) return (a->mod < b->mod) ? -1 : 1;
+    return (a->blk < b->blk) ? -1 : (a->blk > b->blk);
+}
+// tails found in more than one module are lowered once into the common region. returns the
+// offset there of every block of every module, UINT32_MAX for blocks each module keeps itself
+static uint32_t** share_tails(GenContext* ctx, const quosiIrFunc* funcs) {
+    uint32_t** shared = NULL;
+    SharedKey* keys = NULL;
+    for (uint32_t m = 0; m < (uint32_t)quosids_arrlenu(funcs); m++) {
+        const quosiIrFunc* fn = &funcs[m];
+        uint32_t* offsets = NULL;
+        quosids_arraddn(offsets, quosids_arrlenu(fn->blocks));
+        memset(offsets, 0xFF, quosids_arrlenu(offsets) * sizeof(uint32_t));
+        quosids_arrpush(shared, offsets);
+        if (ctx->opts.opt_level < QUOSI_OPT_FULL) continue;
+        for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+            const uint32_t b = fn->layout[i];
+            if (shareable(&fn->blocks[b])) {
+                quosids_arrpush(keys, ((SharedKey){ quosi_ir_tail_hash(&fn->blocks[b], 0), m, b }));
+            }
+        }
+    }
+    if (keys) qsort(keys, quosids_arrlenu(keys), sizeof(SharedKey), shared_key_cmp);
+
+    bool* taken = NULL;
+    quosids_arraddn(taken, quosids_arrlenu(keys));
+    memset(taken, 0, quosids_arrlenu(keys) * sizeof(bool));
+    for (size_t i = 0; i < quosids_arrlenu(keys); i++) {
+        if (taken[i]) continue;
+        const quosiIrBlock* lead = &funcs[keys[i].mod].blocks[keys[i].blk];
+        bool across = false;
+        for (size_t j = i + 1; j < quosids_arrlenu(keys) && keys[j].hash == keys[i].hash; j++) {
+            if (keys[j].mod != keys[i].mod && same_block(lead, &funcs[keys[j].mod].blocks[keys[j].blk])) across = true;
+        }
+        if (!across) continue;
+        const uint32_t at = lower_shared(ctx, lead);
+        for (size_t j = i; j < quosids_arrlenu(keys) && keys[j].hash == keys[i].hash; j++) {
+            if (!taken[j] && same_block(lead, &funcs[keys[j].mod].blocks[keys[j].blk])) {
+                taken[j] = true;
+                shared[keys[j].mod][keys[j].blk] = at;
+            }
+        }
+    }
+    quosids_arrfree(keys);
+    quosids_arrfree(taken);
+    return shared;
+}
+// emits the blocks of ctx->fn in layout order, returns the offset of every block, UINT32_MAX if not laid out
+static uint32_t* lower_func(GenContext* ctx) {
+    const quosiIrFunc* fn = &ctx->fn;
+    const size_t n = quosids_arrlenu(fn->layout);
+    uint32_t* offsets = NULL;
+    quosids_arraddn(offsets, quosids_arrlenu(fn->blocks));
+    memset(offsets, 0xFF, quosids_arrlenu(offsets) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        const quosiIrBlock* blk = &fn->blocks[fn->layout[i]];
+        offsets[fn->layout[i]] = (uint32_t)quosids_arrlenu(ctx->result);
+        for (size_t j = 0; j < quosids_arrlenu(blk->code); j++) {
+            lower_instr(ctx, &blk->code[j]);
+        }
+        lower_term(ctx, &blk->term, (i + 1 < n) ? fn->layout[i+1] : QUOSI_IR_EXIT);
+    }
+    return offsets;
+}
+
+
+
+
+static void collect_visits_expr(GenContext* ctx, const quosiExpr* e) {
+    switch (e->tag) {
+    case QUOSI_EXPR_VISITS: {
+        const uint32_t v = resolve_edge(ctx, e->value.ident);
+        if (v < quosids_arrlenu(ctx->name_lkp->vertices) && ctx->counters[v] == UINT32_MAX) {
+            // VISIT and SEEN would abort on the counter at runtime
+            if (ctx->counter_index >= QUOSI_VISIT_COUNTER_SIZE) gen_error(ctx, e->value.ident, QUOSI_ERR_TOO_MANY_COUNTERS);
+            ctx->counters[v] = ctx->counter_index++;
+        }
+        break; }
+    case QUOSI_EXPR_CALL:
+        for (size_t i = 0; i < quosids_arrlenu(e->value.call.args); i++) {
+            collect_visits_expr(ctx, &e->value.call.args[i]);
+        }
+        break;
+    case QUOSI_EXPR_OP:
+        collect_visits_expr(ctx, e->lhs);
+        if (e->value.op != QUOSI_INSTR_NEG && e->value.op != QUOSI_INSTR_LNOT) {
+            collect_visits_expr(ctx, e->rhs);
+        }
+        break;
+    default:
+        break;
+    }
+}
+static void collect_visits_effects(GenContext* ctx, const quosiEffect* effs) {
+    for (size_t i = 0; i < quosids_arrlenu(effs); i++) {
+        if (effs[i].op != QUOSI_EFFECT_EVENT) {
+            collect_visits_expr(ctx, &effs[i].rhs);
+        }
+    }
+}
+static void collect_visits_eblock(GenContext* ctx, const quosiEdgeBlock* b) {
+    switch (b->tag) {
+    case QUOSI_EBLOCK_T:
+        for (size_t i = 0; i < quosids_arrlenu(b->value.edges); i++) {
+            collect_visits_effects(ctx, b->value.edges[i].effects);
+        }
+        break;
+    case QUOSI_EBLOCK_MATCH:
+        collect_visits_expr(ctx, &b->value.match.expr);
+        for (size_t i = 0; i < quosids_arrlenu(b->value.match.arms); i++) {
+            collect_visits_effects(ctx, b->value.match.arms[i].body.effects);
+        }
+        if (b->value.match.catchall.exists) {
+            collect_visits_effects(ctx, b->value.match.catchall.arm.effects);
+        }
+        break;
+    case QUOSI_EBLOCK_IFELSE:
+        for (size_t i = 0; i < quosids_arrlenu(b->value.ifelse.blocks); i++) {
+            collect_visits_expr(ctx, &b->value.ifelse.blocks[i].cond);
+            for (size_t j = 0; j < quosids_arrlenu(b->value.ifelse.blocks[i].body); j++) {
+                collect_visits_eblock(ctx, &b->value.ifelse.blocks[i].body[j]);
+            }
+        }
+        for (size_t i = 0; i < quosids_arrlenu(b->value.ifelse.catchall); i++) {
+            collect_visits_eblock(ctx, &b->value.ifelse.catchall[i]);
+        }
+        break;
+    }
+}
+static void collect_visits_vertex(GenContext* ctx, const quosiVertex* v) {
+    if (v->type == QUOSI_VERTEX_JUMP) {
+        collect_visits_effects(ctx, v->v.jump.effects);
+    } else {
+        for (size_t i = 0; i < quosids_arrlenu(v->v.edges); i++) {
+            collect_visits_eblock(ctx, &v->v.edges[i]);
+        }
+    }
+}
+static void collect_visits_vblock(GenContext* ctx, const quosiVertexBlock* b) {
+    switch (b->tag) {
+    case QUOSI_VBLOCK_T:
+        collect_visits_vertex(ctx, &b->value.vertex);
+        break;
+    case QUOSI_VBLOCK_MATCH:
+        collect_visits_expr(ctx, &b->value.match.expr);
+        for (size_t i = 0; i < quosids_arrlenu(b->value.match.arms); i++) {
+            collect_visits_vertex(ctx, &b->value.match.arms[i].body);
+        }
+        collect_visits_vertex(ctx, &b->value.match.catchall);
+        break;
+    case QUOSI_VBLOCK_IFELSE:
+        for (size_t i = 0; i < quosids_arrlenu(b->value.ifelse.blocks); i++) {
+            collect_visits_expr(ctx, &b->value.ifelse.blocks[i].cond);
+            collect_visits_vblock(ctx, b->value.ifelse.blocks[i].data);
+        }
+        collect_visits_vblock(ctx, b->value.ifelse.catchall);
+        break;
+    case QUOSI_VBLOCK_RANDOM:
+        for (size_t i = 0; i < quosids_arrlenu(b->value.random.arms); i++) {
+            collect_visits_vertex(ctx, &b->value.random.arms[i].body);
+        }
+        break;
+    case QUOSI_VBLOCK_IMPORT:
+        break;
+    }
+}
@@ -0,0 +1,156 @@
+#include "ir.h"
+#include <string.h>
+#define QUOSIDS_ALLOCATOR (fn->alloc)
+#include "vec.h"
+
+
+// registered in pipeline order, each pass leaves the function valid for the next
+static const quosiIrPass PASSES[] = {
+    { "fold", QUOSI_OPT_DEFAULT, quosi_ir_pass_fold },
+    { "merge", QUOSI_OPT_FULL, quosi_ir_pass_merge },
+    { "thread", QUOSI_OPT_FULL, quosi_ir_pass_thread },
+    { "loads", QUOSI_OPT_DEFAULT, quosi_ir_pass_loads },
+    { NULL, 0, NULL },
+};
+
+
+void quosi_ir_init(quosiIrFunc* fn, quosiAllocator alloc) {
+    *fn = (quosiIrFunc){ .alloc=alloc, .current=QUOSI_IR_EXIT };
+}
+void quosi_ir_free(quosiIrFunc* fn) {
+    for (size_t i = 0; i < quosids_arrlenu(fn->blocks); i++) {
+        quosids_arrfree(fn->blocks[i].code);
+        quosids_arrfree(fn->blocks[i].term.targets);
+        quosids_arrfree(fn->blocks[i].term.probs);
+    }
+    quosids_arrfree(fn->blocks);
+    quosids_arrfree(fn->layout);
+}
+
+uint32_t quosi_ir_block(quosiIrFunc* fn) {
+    quosids_arrpush(fn->blocks, ((quosiIrBlock){ 0 }));
+    return (uint32_t)(quosids_arrlenu(fn->blocks) - 1);
+}
+void quosi_ir_place(quosiIrFunc* fn, uint32_t blk) {
+    if (fn->current != QUOSI_IR_EXIT) {
+        quosi_ir_jump(fn, blk);
+    }
+    quosids_arrpush(fn->layout, blk);
+    fn->current = blk;
+}
+void quosi_ir_emit(quosiIrFunc* fn, quosiIrInstr instr) {
+    if (fn->current == QUOSI_IR_EXIT) {
+        // code after a terminator is unreachable, but still gets a home
+        quosi_ir_place(fn, quosi_ir_block(fn));
+    }
+    quosids_arrpush(fn->blocks[fn->current].code, instr);
+}
+void quosi_ir_term(quosiIrFunc* fn, quosiIrTerm term) {
+    if (fn->current == QUOSI_IR_EXIT) {
+        quosi_ir_place(fn, quosi_ir_block(fn));
+    }
+    fn->blocks[fn->current].term = term;
+    fn->current = QUOSI_IR_EXIT;
+}
+void quosi_ir_jump(quosiIrFunc* fn, uint32_t target) {
+    quosi_ir_term(fn, (quosiIrTerm){ .kind=QUOSI_IR_TERM_JUMP, .target=target });
+}
+void quosi_ir_branch(quosiIrFunc* fn, uint8_t op, uint32_t target) {
+    const uint32_t next = quosi_ir_block(fn);
+    quosi_ir_term(fn, (quosiIrTerm){ .kind=QUOSI_IR_TERM_BRANCH, .op=op, .target=target, .next=next });
+    quosi_ir_place(fn, next);
+}
+void quosi_ir_switch(quosiIrFunc* fn, uint32_t* targets) {
+    const uint32_t next = quosi_ir_block(fn);
+    quosi_ir_term(fn, (quosiIrTerm){ .kind=QUOSI_IR_TERM_SWITCH, .next=next, .targets=targets });
+    quosi_ir_place(fn, next);
+}
+
+uint32_t quosi_ir_succ_count(const quosiIrTerm* t) {
+    switch (t->kind) {
+    case QUOSI_IR_TERM_JUMP:   return 1;
+    case QUOSI_IR_TERM_BRANCH: return 2;
+    case QUOSI_IR_TERM_SWITCH: return (uint32_t)quosids_arrlenu(t->targets) + 1;
+    case QUOSI_IR_TERM_RAND:
+    case QUOSI_IR_TERM_CALLM:  return (uint32_t)quosids_arrlenu(t->targets);
+    default:                   return 0;
+    }
+}
+uint32_t* quosi_ir_succ(quosiIrTerm* t, uint32_t i) {
+    switch (t->kind) {
+    case QUOSI_IR_TERM_JUMP:
+        return &t->target;
+    case QUOSI_IR_TERM_BRANCH:
+        return (i == 0) ? &t->target : &t->next;
+    case QUOSI_IR_TERM_SWITCH:
+        return (i < quosids_arrlenu(t->targets)) ? &t->targets[i] : &t->next;
+    default:
+        return &t->targets[i];
+    }
+}
+
+uint32_t quosi_ir_instr_size(const quosiIrInstr* in) {
+    switch (in->op) {
+    case QUOSI_INSTR_PUSH: case QUOSI_INSTR_IEQV:
+        return 1 + sizeof(uint64_t);
+    case QUOSI_INSTR_LOAD: case QUOSI_INSTR_STORE: case QUOSI_INSTR_IEQK:
+    case QUOSI_INSTR_EVENT: case QUOSI_INSTR_VISIT: case QUOSI_INSTR_SEEN: case QUOSI_INSTR_PROBE:
+        return 1 + sizeof(uint32_t);
+    case QUOSI_INSTR_CALL:   return 2 + sizeof(uint32_t);
+    case QUOSI_INSTR_TSAVE: case QUOSI_INSTR_TLOAD:
+        return 2;
+    case QUOSI_INSTR_PROP:   return 1 + sizeof(uint32_t) + sizeof(uint16_t);
+    case QUOSI_INSTR_PROPT:  return 1 + 2 * sizeof(uint32_t) + sizeof(uint16_t);
+    case QUOSI_INSTR_LINE:   return 1 + 3 * sizeof(uint32_t);
+    case QUOSI_INSTR_LINET:  return 1 + 4 * sizeof(uint32_t);
+    default:                 return 1;
+    }
+}
+
+bool quosi_ir_same_instr(const quosiIrInstr* a, const quosiIrInstr* b) {
+    return a->op == b->op && a->argc == b->argc && a->idx == b->idx && a->a == b->a && a->b == b->b && a->imm == b->imm
+        && a->str.len == b->str.len && (a->str.len == 0 || memcmp(a->str.ptr, b->str.ptr, a->str.len) == 0);
+}
+bool quosi_ir_same_term(const quosiIrTerm* a, const quosiIrTerm* b) {
+    if (a->kind != b->kind || a->op != b->op || a->target != b->target || a->next != b->next || a->arg != b->arg) return false;
+    const size_t nt = quosids_arrlenu(a->targets);
+    const size_t np = quosids_arrlenu(a->probs);
+    return nt == quosids_arrlenu(b->targets) && np == quosids_arrlenu(b->probs)
+        && (nt == 0 || memcmp(a->targets, b->targets, nt * sizeof(uint32_t)) == 0)
+        && (np == 0 || memcmp(a->probs, b->probs, np * sizeof(uint32_t)) == 0);
+}
+
+// FNV-1a, folded in one word at a time
+static uint32_t hash_word(uint32_t h, uint64_t w) {
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        h = (h ^ (uint8_t)(w >> (8 * i))) * 16777619u;
+    }
+    return h;
+}
+uint32_t quosi_ir_tail_hash(const quosiIrBlock* blk, size_t from) {
+    const quosiIrTerm* t = &blk->term;
+    uint32_t h = 2166136261u;
+    h = hash_word(h, ((uint64_t)t->kind << 8) | t->op);
+    h = hash_word(h, ((uint64_t)t->target << 32) | t->next);
+    h = hash_word(h, t->arg);
+    for (size_t i = 0; i < quosids_arrlenu(t->targets); i++) h = hash_word(h, t->targets[i]);
+    for (size_t i = 0; i < quosids_arrlenu(t->probs); i++)   h = hash_word(h, t->probs[i]);
+    for (size_t i = from; i < quosids_arrlenu(blk->code); i++) {
+        const quosiIrInstr* in = &blk->code[i];
+        h = hash_word(h, ((uint64_t)in->op << 24) | ((uint64_t)in->argc << 16) | in->idx);
+        h = hash_word(h, ((uint64_t)in->a << 32) | in->b);
+        h = hash_word(h, in->imm);
+        for (size_t j = 0; j < in->str.len; j++) {
+            h = (h ^ (uint8_t)in->str.ptr[j]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+void quosi_ir_optimize(quosiIrFunc* fn, const quosiCompileOptions* opts) {
+    for (const quosiIrPass* p = PASSES; p->run != NULL; p++) {
+        if (p->level <= opts->opt_level) {
+            p->run(fn);
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef CQUOSI_IMPL_IR_H
+#define CQUOSI_IMPL_IR_H
+#include "quosi/quosi.h"
+#include "quosi/bc.h"
+#include <stdbool.h>
+
+
+// block ID standing for the end of the conversation, lowers to QUOSI_VERTEX_EXIT
+#define QUOSI_IR_EXIT UINT32_MAX
+
+// one straight line instruction, which operands are meaningful depends on op
+typedef struct quosiIrInstr {
+    uint8_t op;
+    // CALL argc
+    uint8_t argc;
+    // PROP and PROPT edge index
+    uint16_t idx;
+    // LOAD, STORE, IEQK key, EVENT ID, VISIT and SEEN counter, CALL function, LINE speaker
+    uint32_t a;
+    // LINE ID
+    uint32_t b;
+    // PUSH and IEQV immediate
+    uint64_t imm;
+    // LINE and PROP text, interned when lowered
+    quosiStrView str;
+} quosiIrInstr;
+
+typedef enum quosiIrTermKind {
+    // block still open, only ever seen while building
+    QUOSI_IR_TERM_NONE = 0,
+    QUOSI_IR_TERM_JUMP,
+    // JZ or JNZ to target, else next
+    QUOSI_IR_TERM_BRANCH,
+    // targets indexed by the popped value, else next
+    QUOSI_IR_TERM_SWITCH,
+    // alias table, targets holds [target, alias] per column
+    QUOSI_IR_TERM_RAND,
+    // enters module arg, returns through targets
+    QUOSI_IR_TERM_CALLM,
+    // returns through target arg of the importer
+    QUOSI_IR_TERM_RETX,
+} quosiIrTermKind;
+
+typedef struct quosiIrTerm {
+    quosiIrTermKind kind;
+    uint8_t op;
+    uint32_t target;
+    uint32_t next;
+    uint32_t arg;
+    // vector
+    uint32_t* targets;
+    // vector, RAND column probabilities
+    uint32_t* probs;
+} quosiIrTerm;
+
+typedef struct quosiIrBlock {
+    // vector
+    quosiIrInstr* code;
+    quosiIrTerm term;
+    // entered from outside the function (vertex table, module entry, exit parameters), passes keep these
+    bool entry;
+} quosiIrBlock;
+
+// one module, blocks are indexed by ID and emitted in layout order
+typedef struct quosiIrFunc {
+    quosiAllocator alloc;
+    // vector
+    quosiIrBlock* blocks;
+    // vector, IDs of placed blocks in emission order
+    uint32_t* layout;
+    // block receiving emitted instructions, QUOSI_IR_EXIT if the last one was terminated
+    uint32_t current;
+} quosiIrFunc;
+
+typedef struct quosiIrPass {
+    const char* name;
+    // lowest opt_level that runs the pass
+    uint32_t level;
+    void(*run)(quosiIrFunc* fn);
+} quosiIrPass;
+
+
+void quosi_ir_init(quosiIrFunc* fn, quosiAllocator alloc);
+void quosi_ir_free(quosiIrFunc* fn);
+
+// new block, not part of the layout until placed
+uint32_t quosi_ir_block(quosiIrFunc* fn);
+// appends blk to the layout and makes it current, an open current block falls through into it
+void quosi_ir_place(quosiIrFunc* fn, uint32_t blk);
+void quosi_ir_emit(quosiIrFunc* fn, quosiIrInstr instr);
+// terminates the current block
+void quosi_ir_term(quosiIrFunc* fn, quosiIrTerm term);
+void quosi_ir_jump(quosiIrFunc* fn, uint32_t target);
+// terminates the current block and places a fresh one as its fall through
+void quosi_ir_branch(quosiIrFunc* fn, uint8_t op, uint32_t target);
+void quosi_ir_switch(quosiIrFunc* fn, uint32_t* targets);
+
+// successors of a terminator, slots may be rewritten in place. QUOSI_IR_EXIT is a valid successor
+uint32_t  quosi_ir_succ_count(const quosiIrTerm* term);
+uint32_t* quosi_ir_succ(quosiIrTerm* term, uint32_t i);
+
+// bytes the instruction lowers to
+uint32_t quosi_ir_instr_size(const quosiIrInstr* instr);
+bool quosi_ir_same_instr(const quosiIrInstr* a, const quosiIrInstr* b);
+// successors are compared by block ID, so only terms of the same function compare meaningfully
+bool quosi_ir_same_term(const quosiIrTerm* a, const quosiIrTerm* b);
+// hash of the terminator and the instructions from index from onwards, equal tails hash equal
+uint32_t quosi_ir_tail_hash(const quosiIrBlock* blk, size_t from);
+
+// runs every registered pass up to opts->opt_level, in order
+void quosi_ir_optimize(quosiIrFunc* fn, const quosiCompileOptions* opts);
+
+// constant folding, branch folding, block merging and removal of blocks nothing reaches
+void quosi_ir_pass_fold(quosiIrFunc* fn);
+// blocks identical to another are dropped for it, and a tail shared by several blocks is kept once
+void quosi_ir_pass_merge(quosiIrFunc* fn);
+// jump threading, and layout of blocks with a single jumping predecessor right behind it
+void quosi_ir_pass_thread(quosiIrFunc* fn);
+// each key is fetched from the host at most once per straight line of code between upcalls
+void quosi_ir_pass_loads(quosiIrFunc* fn);
+
+
+#endif
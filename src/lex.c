@@ -22,13 +22,19 @@ static bool is_keyword(quosiStrView str) {
     if (STREQ(str, "else"))   return true;
     if (STREQ(str, "match"))  return true;
     if (STREQ(str, "with"))   return true;
+    if (STREQ(str, "random")) return true;
     if (STREQ(str, "end"))    return true;
     if (STREQ(str, "true"))   return true;
     if (STREQ(str, "false"))  return true;
     if (STREQ(str, "inf"))    return true;
+    if (STREQ(str, "once"))   return true;
+    if (STREQ(str, "visits")) return true;
     if (STREQ(str, "rename")) return true;
     if (STREQ(str, "module")) return true;
     if (STREQ(str, "endmod")) return true;
+    if (STREQ(str, "const"))  return true;
+    if (STREQ(str, "enum"))   return true;
+    if (STREQ(str, "import")) return true;
     return false;
 }
 
@@ -10,48 +10,123 @@
 
 
 quosiFile* quosi_file_internal_merge_blobs(const quosiProgramData* pdata, quosiAllocator alloc);
+static quosiFileHeader blob_header(const quosiProgramData* pdata);
+static void blob_write(const quosiProgramData* pdata, const quosiFileHeader* header, uint8_t* base_ptr);
 
-quosiFile* quosi_file_compile_from_src(const char* src, quosiError* errors, quosiSymbolCtx symbol_ctx, quosiAllocator alloc) {
+static bool only_warnings(const quosiError* errors) {
+    for (size_t i = 0; i < quosi_error_list_len(errors); i++) {
+        if (!quosi_error_is_warning(errors->list[i])) return false;
+    }
+    return true;
+}
+
+// unless asked for, warnings leave no trace, so list == NULL still means success
+static void drop_warnings(quosiError* errors, const quosiCompileOptions* opts) {
+    if (opts && opts->warnings) return;
+    size_t n = 0;
+    for (size_t i = 0; i < quosi_error_list_len(errors); i++) {
+        if (!quosi_error_is_warning(errors->list[i])) errors->list[n++] = errors->list[i];
+    }
+    if (n == 0) {
+        quosi_error_list_free(errors);
+    } else {
+        quosids_header(errors->list)->len = n;
+    }
+}
+
+quosiFile* quosi_file_compile_from_src(const char* src, quosiError* errors, quosiSymbolCtx symbol_ctx, const quosiCompileOptions* opts, quosiAllocator alloc) {
     *errors = (quosiError){ 0 };
     quosiMemoryArena ast_arena = quosi_memory_arena_create(QUOSI_MEMORY_ARENA_PAGE, 100 * 1000);
     const quosiAst ast = quosi_ast_parse_from_src(src, errors, quosi_memory_arena_allocator(&ast_arena));
 
-    if (errors->list == NULL) {
+    quosiFile* result = NULL;
+    if (only_warnings(errors)) {
         quosiMemoryArena pdata_arena = quosi_memory_arena_create(QUOSI_MEMORY_ARENA_PAGE, 100 * 1000);
-        quosiProgramData pdata = quosi_compile_ast(&ast, symbol_ctx, quosi_memory_arena_allocator(&pdata_arena));
+        quosiProgramData pdata = quosi_compile_ast(&ast, symbol_ctx, opts, errors, quosi_memory_arena_allocator(&pdata_arena));
         quosi_memory_arena_destroy(&ast_arena);
-        quosiFile* result = quosi_file_internal_merge_blobs(&pdata, alloc);
+        if (only_warnings(errors)) result = quosi_file_internal_merge_blobs(&pdata, alloc);
         quosi_memory_arena_destroy(&pdata_arena);
-        return result;
     } else {
         quosi_memory_arena_destroy(&ast_arena);
-        return NULL;
     }
+    drop_warnings(errors, opts);
+    return result;
+}
+
+struct quosiFileBuild {
+    // owns every vector of pdata
+    quosiMemoryArena arena;
+    quosiProgramData pdata;
+    quosiFileHeader header;
+    quosiAllocator alloc;
+};
+
+quosiFileBuild* quosi_file_build(const char* src, quosiError* errors, quosiSymbolCtx symbol_ctx, const quosiCompileOptions* opts, quosiAllocator alloc) {
+    *errors = (quosiError){ 0 };
+    quosiMemoryArena ast_arena = quosi_memory_arena_create(QUOSI_MEMORY_ARENA_PAGE, 100 * 1000);
+    const quosiAst ast = quosi_ast_parse_from_src(src, errors, quosi_memory_arena_allocator(&ast_arena));
+
+    quosiFileBuild* result = NULL;
+    if (only_warnings(errors)) {
+        // the arena allocator points at the arena, so it is created where it lives until the build is freed
+        result = quosi_allocator_allocate(alloc, sizeof(quosiFileBuild));
+        result->arena = quosi_memory_arena_create(QUOSI_MEMORY_ARENA_PAGE, 100 * 1000);
+        result->alloc = alloc;
+        result->pdata = quosi_compile_ast(&ast, symbol_ctx, opts, errors, quosi_memory_arena_allocator(&result->arena));
+        quosi_memory_arena_destroy(&ast_arena);
+        if (only_warnings(errors)) {
+            result->header = blob_header(&result->pdata);
+        } else {
+            quosi_file_build_free(result);
+            result = NULL;
+        }
+    } else {
+        quosi_memory_arena_destroy(&ast_arena);
+    }
+    drop_warnings(errors, opts);
+    return result;
 }
 
-quosiFile* quosi_file_compile_from_ast(const quosiAst* ast, quosiSymbolCtx symbol_ctx, quosiAllocator alloc) {
+size_t quosi_file_build_size(const quosiFileBuild* build) {
+    return build->header.fsize;
+}
+
+void quosi_file_build_write(const quosiFileBuild* build, void* buf) {
+    blob_write(&build->pdata, &build->header, buf);
+}
+
+void quosi_file_build_free(quosiFileBuild* build) {
+    quosi_memory_arena_destroy(&build->arena);
+    quosi_allocator_deallocate(build->alloc, build);
+}
+
+quosiFile* quosi_file_compile_from_ast(const quosiAst* ast, quosiError* errors, quosiSymbolCtx symbol_ctx, const quosiCompileOptions* opts, quosiAllocator alloc) {
     quosiMemoryArena arena = quosi_memory_arena_create(QUOSI_MEMORY_ARENA_PAGE, 100 * 1000);
-    quosiProgramData pdata = quosi_compile_ast(ast, symbol_ctx, quosi_memory_arena_allocator(&arena));
-    quosiFile* result = quosi_file_internal_merge_blobs(&pdata, alloc);
+    quosiProgramData pdata = quosi_compile_ast(ast, symbol_ctx, opts, errors, quosi_memory_arena_allocator(&arena));
+    quosiFile* result = only_warnings(errors) ? quosi_file_internal_merge_blobs(&pdata, alloc) : NULL;
     quosi_memory_arena_destroy(&arena);
+    drop_warnings(errors, opts);
     return result;
 }
 
-quosiFile* quosi_file_internal_merge_blobs(const quosiProgramData* pdata, quosiAllocator alloc) {
+// every section position and the total size follow from pdata alone, before anything is written
+static quosiFileHeader blob_header(const quosiProgramData* pdata) {
     const size_t meta_size = sizeof(quosiFileHeader) + quosids_arrlenu(pdata->syms);
     size_t mods_size = 0;
-    size_t code_size = 0;
+    size_t code_size = quosids_arrlenu(pdata->common);
     size_t strs_size = quosids_arrlenu(pdata->strs);
+    const size_t tmpl_size = quosids_arrlenu(pdata->tmpl);
+    const size_t evts_size = quosids_arrlenu(pdata->evts);
+    const size_t line_size = quosids_arrlenu(pdata->lines);
+    const size_t vert_size = quosids_arrlenu(pdata->verts);
     for (size_t i = 0; i < quosids_arrlenu(pdata->mods); i++) {
         mods_size += 4 * sizeof(uint32_t);
         code_size += quosids_arrlenu(pdata->mods[i].code);
-        strs_size += (pdata->mods[i].name.len + 1);
+        strs_size += sizeof(uint32_t) + (pdata->mods[i].name.len + 1);
     }
-    const size_t file_size = meta_size + mods_size + code_size + strs_size;
+    const size_t file_size = meta_size + mods_size + code_size + strs_size + tmpl_size + evts_size + line_size + vert_size;
 
-    uint8_t* base_ptr = quosi_allocator_allocate(alloc, file_size);
-    quosiFileHeader* header = (quosiFileHeader*)base_ptr;
-    *header = (quosiFileHeader){
+    return (quosiFileHeader){
         .magic={ 'q', 'u', 'o', 's', 'i' },
         .majver=VANGO_PKG_VERSION_MAJOR,
         .minver=VANGO_PKG_VERSION_MINOR,
@@ -60,12 +135,47 @@ quosiFile* quosi_file_internal_merge_blobs(const quosiProgramData* pdata, quosiA
         .nmods =(uint32_t)quosids_arrlenu(pdata->mods),
         .code_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size),
         .strs_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size),
-        .syms_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size),
+        .tmpl_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size),
+        .evts_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size + tmpl_size),
+        .line_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size + tmpl_size + evts_size),
+        .vert_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size + tmpl_size + evts_size + line_size),
+        .syms_pos=(uint32_t)(sizeof(quosiFileHeader) + mods_size + code_size + strs_size + tmpl_size + evts_size + line_size + vert_size),
+        .nprobes =pdata->nprobes,
     };
+}
+
+// base_ptr holds header->fsize bytes, each section is copied straight into place
+// an empty section is a NULL vector, which memcpy must not see even for 0 bytes
+static void copy_section(uint8_t* dst, const void* src, size_t len) {
+    if (len != 0) memcpy(dst, src, len);
+}
+
+static void blob_write(const quosiProgramData* pdata, const quosiFileHeader* header, uint8_t* base_ptr) {
+    // member by member over zeroed memory, so padding never carries stack garbage into the file
+    quosiFileHeader* out = (quosiFileHeader*)base_ptr;
+    memset(out, 0, sizeof(quosiFileHeader));
+    memcpy(out->magic, header->magic, sizeof(out->magic));
+    out->majver = header->majver;
+    out->minver = header->minver;
+    out->patch = header->patch;
+    out->fsize = header->fsize;
+    out->nmods = header->nmods;
+    out->code_pos = header->code_pos;
+    out->strs_pos = header->strs_pos;
+    out->tmpl_pos = header->tmpl_pos;
+    out->evts_pos = header->evts_pos;
+    out->line_pos = header->line_pos;
+    out->vert_pos = header->vert_pos;
+    out->syms_pos = header->syms_pos;
+    out->nprobes = header->nprobes;
+    const size_t tmpl_size = quosids_arrlenu(pdata->tmpl);
+    const size_t evts_size = quosids_arrlenu(pdata->evts);
+    const size_t line_size = quosids_arrlenu(pdata->lines);
+    const size_t vert_size = quosids_arrlenu(pdata->verts);
 
     uint8_t* current = base_ptr + sizeof(quosiFileHeader);
     uint32_t code_pos = header->code_pos;
-    uint32_t name_pos = header->strs_pos + (uint32_t)quosids_arrlenu(pdata->strs);
+    uint32_t name_pos = header->strs_pos + (uint32_t)quosids_arrlenu(pdata->strs) + (uint32_t)sizeof(uint32_t);
     for (size_t i = 0; i < quosids_arrlenu(pdata->mods); i++) {
         const quosiModData* g = &pdata->mods[i];
         const uint32_t code_len = (uint32_t)quosids_arrlenu(g->code);
@@ -76,46 +186,73 @@ quosiFile* quosi_file_internal_merge_blobs(const quosiProgramData* pdata, quosiA
         current += 4 * sizeof(uint32_t);
         code_pos += code_len;
 
+        const uint32_t name_len = (uint32_t)g->name.len;
+        memcpy(base_ptr + name_pos - sizeof(uint32_t), &name_len, sizeof(uint32_t));
         memcpy(base_ptr + name_pos, g->name.ptr, g->name.len);
         base_ptr[name_pos + g->name.len] = 0;
 
-        name_pos += (uint32_t)g->name.len + 1;
+        name_pos += (uint32_t)sizeof(uint32_t) + name_len + 1;
     }
 
     current = base_ptr + header->code_pos;
     for (size_t i = 0; i < quosids_arrlenu(pdata->mods); i++) {
         const quosiModData* g = &pdata->mods[i];
         const size_t code_len = quosids_arrlenu(g->code);
-        memcpy(current, g->code, code_len);
+        copy_section(current, g->code, code_len);
         current += code_len;
     }
+    copy_section(current, pdata->common, quosids_arrlenu(pdata->common));
+
+    copy_section(base_ptr + header->strs_pos, pdata->strs, quosids_arrlenu(pdata->strs));
+    copy_section(base_ptr + header->tmpl_pos, pdata->tmpl, tmpl_size);
+    copy_section(base_ptr + header->evts_pos, pdata->evts, evts_size);
+    copy_section(base_ptr + header->line_pos, pdata->lines, line_size);
+    copy_section(base_ptr + header->vert_pos, pdata->verts, vert_size);
+    copy_section(base_ptr + header->syms_pos, pdata->syms, quosids_arrlenu(pdata->syms));
+}
 
-    memcpy(base_ptr + header->strs_pos, pdata->strs, quosids_arrlenu(pdata->strs));
-    memcpy(base_ptr + header->syms_pos, pdata->syms, quosids_arrlenu(pdata->syms));
+quosiFile* quosi_file_internal_merge_blobs(const quosiProgramData* pdata, quosiAllocator alloc) {
+    const quosiFileHeader header = blob_header(pdata);
+    uint8_t* base_ptr = quosi_allocator_allocate(alloc, header.fsize);
+    blob_write(pdata, &header, base_ptr);
     return (quosiFile*)base_ptr;
 }
 
 
+quosiStrView quosi_strview(const char* str) {
+    uint32_t len;
+    memcpy(&len, str - sizeof(uint32_t), sizeof(uint32_t));
+    return (quosiStrView){ str, len };
+}
+
 const quosiFileHeader* quosi_file_header(const quosiFile* file) {
     return (quosiFileHeader*)file;
 }
 quosiFileModTableEntry quosi_file_module(const quosiFile* file, const char* module) {
+    return quosi_file_module_by_index(file, quosi_file_module_index(file, module));
+}
+uint32_t quosi_file_module_index(const quosiFile* file, const char* module) {
     const uint8_t* base_ptr = (const uint8_t*)file;
     const uint8_t* ptr = quosi_file_mod_table(file);
     for (uint32_t i = 0; i < quosi_file_header(file)->nmods; i++) {
-        uint32_t name_pos, code_pos, code_len, code_beg;
-        memcpy(&name_pos, ptr,                        sizeof(uint32_t));
-        memcpy(&code_pos, ptr + 1 * sizeof(uint32_t), sizeof(uint32_t));
-        memcpy(&code_len, ptr + 2 * sizeof(uint32_t), sizeof(uint32_t));
-        memcpy(&code_beg, ptr + 3 * sizeof(uint32_t), sizeof(uint32_t));
-        const char* name = (const char*)base_ptr + name_pos;
-        const size_t name_len = strlen((const char*)ptr);
-        if (strncmp(name, module, name_len+1) == 0) {
-            return (quosiFileModTableEntry){ .code=base_ptr+code_pos, .len=code_len, .entry=code_beg };
+        uint32_t name_pos;
+        memcpy(&name_pos, ptr, sizeof(uint32_t));
+        if (strcmp((const char*)base_ptr + name_pos, module) == 0) {
+            return i;
         }
         ptr += 4 * sizeof(uint32_t);
     }
-    return (quosiFileModTableEntry){ 0 };
+    return UINT32_MAX;
+}
+quosiFileModTableEntry quosi_file_module_by_index(const quosiFile* file, uint32_t index) {
+    if (index >= quosi_file_header(file)->nmods) return (quosiFileModTableEntry){ 0 };
+    const uint8_t* base_ptr = (const uint8_t*)file;
+    const uint8_t* ptr = quosi_file_mod_table(file) + index * 4 * sizeof(uint32_t);
+    uint32_t code_pos, code_len, code_beg;
+    memcpy(&code_pos, ptr + 1 * sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&code_len, ptr + 2 * sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&code_beg, ptr + 3 * sizeof(uint32_t), sizeof(uint32_t));
+    return (quosiFileModTableEntry){ .code=base_ptr+code_pos, .len=code_len, .entry=code_beg };
 }
 
 const uint8_t* quosi_file_end(const quosiFile* file) {
@@ -124,6 +261,9 @@ const uint8_t* quosi_file_end(const quosiFile* file) {
 size_t quosi_file_len(const quosiFile* file) {
     return quosi_file_header(file)->fsize;
 }
+uint32_t quosi_file_probe_count(const quosiFile* file) {
+    return quosi_file_header(file)->nprobes;
+}
 
 const uint8_t* quosi_file_mod_table(const quosiFile* file) {
     return (uint8_t*)file + sizeof(quosiFileHeader);
@@ -141,7 +281,82 @@ const uint8_t* quosi_file_strs(const quosiFile* file) {
     return (uint8_t*)file + quosi_file_header(file)->strs_pos;
 }
 size_t quosi_file_strs_len(const quosiFile* file) {
-    return (size_t)(quosi_file_syms(file) - quosi_file_strs(file));
+    return (size_t)(quosi_file_tmpl(file) - quosi_file_strs(file));
+}
+const uint8_t* quosi_file_tmpl(const quosiFile* file) {
+    return (uint8_t*)file + quosi_file_header(file)->tmpl_pos;
+}
+size_t quosi_file_tmpl_len(const quosiFile* file) {
+    return (size_t)(quosi_file_evts(file) - quosi_file_tmpl(file));
+}
+const uint8_t* quosi_file_evts(const quosiFile* file) {
+    return (uint8_t*)file + quosi_file_header(file)->evts_pos;
+}
+size_t quosi_file_evts_len(const quosiFile* file) {
+    return (size_t)(quosi_file_lines(file) - quosi_file_evts(file));
+}
+uint32_t quosi_file_event_count(const quosiFile* file) {
+    return (uint32_t)(quosi_file_evts_len(file) / sizeof(uint32_t));
+}
+const char* quosi_file_event(const quosiFile* file, uint32_t id) {
+    if (id >= quosi_file_event_count(file)) return NULL;
+    uint32_t pos;
+    memcpy(&pos, quosi_file_evts(file) + id * sizeof(uint32_t), sizeof(uint32_t));
+    return (const char*)quosi_file_strs(file) + pos;
+}
+const uint8_t* quosi_file_lines(const quosiFile* file) {
+    return (uint8_t*)file + quosi_file_header(file)->line_pos;
+}
+size_t quosi_file_lines_len(const quosiFile* file) {
+    return (size_t)(quosi_file_verts(file) - quosi_file_lines(file));
+}
+uint32_t quosi_file_line_count(const quosiFile* file) {
+    return (uint32_t)(quosi_file_lines_len(file) / (3 * sizeof(uint32_t)));
+}
+quosiFileLine quosi_file_line(const quosiFile* file, uint32_t index) {
+    uint32_t rec[3];
+    memcpy(rec, quosi_file_lines(file) + index * sizeof(rec), sizeof(rec));
+    return (quosiFileLine){ .id=rec[0], .speaker=rec[1], .text=(const char*)quosi_file_strs(file) + rec[2] };
+}
+quosiFileLine quosi_file_line_find(const quosiFile* file, uint32_t id) {
+    uint32_t lo = 0;
+    uint32_t hi = quosi_file_line_count(file);
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const quosiFileLine line = quosi_file_line(file, mid);
+        if (line.id == id) return line;
+        if (line.id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (quosiFileLine){ .id=id, .speaker=0, .text=NULL };
+}
+uint32_t quosi_file_vertex(const quosiFile* file, uint32_t module, const char* vertex) {
+    const uint8_t* verts = quosi_file_verts(file);
+    const char* strs = (const char*)quosi_file_strs(file);
+    uint32_t lo = 0;
+    uint32_t hi = (uint32_t)(quosi_file_verts_len(file) / (3 * sizeof(uint32_t)));
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t rec[3];
+        memcpy(rec, verts + mid * sizeof(rec), sizeof(rec));
+        const int c = (rec[0] != module) ? ((rec[0] < module) ? -1 : 1) : strcmp(strs + rec[1], vertex);
+        if (c == 0) return rec[2];
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return UINT32_MAX;
+}
+const uint8_t* quosi_file_verts(const quosiFile* file) {
+    return (uint8_t*)file + quosi_file_header(file)->vert_pos;
+}
+size_t quosi_file_verts_len(const quosiFile* file) {
+    return (size_t)(quosi_file_syms(file) - quosi_file_verts(file));
 }
 const uint8_t* quosi_file_syms(const quosiFile* file) {
     return (uint8_t*)file + quosi_file_header(file)->syms_pos;
@@ -0,0 +1,576 @@
+#include "ir.h"
+#include "quosi/vm.h"
+#include <string.h>
+#include <stdlib.h>
+#define QUOSIDS_ALLOCATOR (fn->alloc)
+#include "vec.h"
+
+
+// evaluates op the way the vm would, false if the result must be left to runtime
+static bool fold_binary(uint8_t op, uint64_t lhs, uint64_t rhs, uint64_t* result) {
+    switch (op) {
+    case QUOSI_INSTR_LAND: *result = (uint64_t)(lhs && rhs); return true;
+    case QUOSI_INSTR_LOR:  *result = (uint64_t)(lhs || rhs); return true;
+    case QUOSI_INSTR_ADD:  *result = lhs + rhs;              return true;
+    case QUOSI_INSTR_SUB:  *result = lhs - rhs;              return true;
+    case QUOSI_INSTR_MUL:  *result = lhs * rhs;              return true;
+    case QUOSI_INSTR_EQU:  *result = (uint64_t)(lhs == rhs); return true;
+    case QUOSI_INSTR_NEQ:  *result = (uint64_t)(lhs != rhs); return true;
+    case QUOSI_INSTR_LEQ:  *result = (uint64_t)(lhs <= rhs); return true;
+    case QUOSI_INSTR_LTH:  *result = (uint64_t)(lhs <  rhs); return true;
+    case QUOSI_INSTR_GEQ:  *result = (uint64_t)(lhs >= rhs); return true;
+    case QUOSI_INSTR_GTH:  *result = (uint64_t)(lhs >  rhs); return true;
+    case QUOSI_INSTR_DIV:
+        // division by zero stays a runtime fault
+        if (rhs == 0) return false;
+        *result = lhs / rhs;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// rewrites the tail of code after each instruction is appended, so folds cascade
+// the way the stack would evaluate them
+static bool fold_block(quosiIrFunc* fn, quosiIrBlock* blk) {
+    quosiIrInstr* code = NULL;
+    bool changed = false;
+    for (size_t i = 0; i < quosids_arrlenu(blk->code); i++) {
+        quosids_arrpush(code, blk->code[i]);
+        for (;;) {
+            const size_t n = quosids_arrlenu(code);
+            quosiIrInstr* top = &code[n-1];
+            if (n < 2 || code[n-2].op != QUOSI_INSTR_PUSH) break;
+            quosiIrInstr* arg = &code[n-2];
+            uint64_t val;
+            if (n >= 3 && code[n-3].op == QUOSI_INSTR_PUSH && fold_binary(top->op, code[n-3].imm, arg->imm, &val)) {
+                code[n-3].imm = val;
+                quosids_header(code)->len -= 2;
+            } else if (top->op == QUOSI_INSTR_LNOT) {
+                arg->imm = (uint64_t)(!arg->imm);
+                quosids_header(code)->len--;
+            } else if (top->op == QUOSI_INSTR_NEG) {
+                arg->imm = (uint64_t)(-(int64_t)arg->imm);
+                quosids_header(code)->len--;
+            } else if (top->op == QUOSI_INSTR_POP) {
+                quosids_header(code)->len -= 2;
+            } else if (top->op == QUOSI_INSTR_DUP) {
+                *top = *arg;
+            } else if (top->op == QUOSI_INSTR_IEQV) {
+                // the scrutinee stays on the stack
+                *top = (quosiIrInstr){ .op=QUOSI_INSTR_PUSH, .imm=(uint64_t)(arg->imm == top->imm) };
+            } else {
+                break;
+            }
+            changed = true;
+            if (quosids_arrlenu(code) == 0) break;
+        }
+    }
+    quosids_arrfree(blk->code);
+    blk->code = code;
+    return changed;
+}
+
+// a branch or switch on a constant becomes a jump to the one successor it can take
+static bool fold_term(quosiIrFunc* fn, quosiIrBlock* blk) {
+    const size_t n = quosids_arrlenu(blk->code);
+    if (n == 0 || blk->code[n-1].op != QUOSI_INSTR_PUSH) return false;
+    const uint64_t val = blk->code[n-1].imm;
+    quosiIrTerm* t = &blk->term;
+    uint32_t dest;
+    if (t->kind == QUOSI_IR_TERM_BRANCH) {
+        const bool taken = (t->op == QUOSI_INSTR_JZ) ? (val == 0) : (val != 0);
+        dest = taken ? t->target : t->next;
+    } else if (t->kind == QUOSI_IR_TERM_SWITCH) {
+        dest = (val < quosids_arrlenu(t->targets)) ? t->targets[val] : t->next;
+        quosids_arrfree(t->targets);
+    } else {
+        return false;
+    }
+    quosids_header(blk->code)->len--;
+    *t = (quosiIrTerm){ .kind=QUOSI_IR_TERM_JUMP, .target=dest };
+    return true;
+}
+
+// marks every block reachable from an entry block, counting the predecessors of each
+static void reach(quosiIrFunc* fn, bool* live, uint32_t* preds) {
+    const size_t nblocks = quosids_arrlenu(fn->blocks);
+    uint32_t* work = NULL;
+    memset(live, 0, nblocks * sizeof(bool));
+    memset(preds, 0, nblocks * sizeof(uint32_t));
+    for (uint32_t i = 0; i < (uint32_t)nblocks; i++) {
+        if (fn->blocks[i].entry) {
+            live[i] = true;
+            quosids_arrpush(work, i);
+        }
+    }
+    while (quosids_arrlenu(work) > 0) {
+        quosiIrTerm* t = &fn->blocks[work[--quosids_header(work)->len]].term;
+        for (uint32_t i = 0; i < quosi_ir_succ_count(t); i++) {
+            const uint32_t s = *quosi_ir_succ(t, i);
+            if (s == QUOSI_IR_EXIT) continue;
+            preds[s]++;
+            if (!live[s]) {
+                live[s] = true;
+                quosids_arrpush(work, s);
+            }
+        }
+    }
+    quosids_arrfree(work);
+}
+
+// appends a block to its only predecessor when that predecessor jumps straight to it
+static bool merge_blocks(quosiIrFunc* fn, const bool* live, uint32_t* preds) {
+    bool changed = false;
+    for (size_t i = 0; i < quosids_arrlenu(fn->blocks); i++) {
+        quosiIrBlock* blk = &fn->blocks[i];
+        if (!live[i]) continue;
+        while (blk->term.kind == QUOSI_IR_TERM_JUMP) {
+            const uint32_t s = blk->term.target;
+            if (s == QUOSI_IR_EXIT || s == i || fn->blocks[s].entry || preds[s] != 1) break;
+            quosiIrBlock* succ = &fn->blocks[s];
+            for (size_t j = 0; j < quosids_arrlenu(succ->code); j++) {
+                quosids_arrpush(blk->code, succ->code[j]);
+            }
+            quosids_arrfree(succ->code);
+            blk->term = succ->term;
+            succ->term = (quosiIrTerm){ 0 };
+            preds[s] = 0;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void quosi_ir_pass_fold(quosiIrFunc* fn) {
+    const size_t nblocks = quosids_arrlenu(fn->blocks);
+    bool* live = NULL;
+    uint32_t* preds = NULL;
+    quosids_arraddn(live, nblocks);
+    quosids_arraddn(preds, nblocks);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < nblocks; i++) {
+            changed |= fold_block(fn, &fn->blocks[i]);
+            changed |= fold_term(fn, &fn->blocks[i]);
+        }
+        reach(fn, live, preds);
+        changed |= merge_blocks(fn, live, preds);
+    }
+
+    // merged blocks are unreachable now too
+    reach(fn, live, preds);
+    size_t n = 0;
+    for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+        if (live[fn->layout[i]]) {
+            fn->layout[n++] = fn->layout[i];
+        }
+    }
+    quosids_header(fn->layout)->len = n;
+
+    quosids_arrfree(live);
+    quosids_arrfree(preds);
+}
+
+
+// a tail shorter than this many bytes costs no more than the JUMP into a shared copy would
+#define TAIL_MIN_BYTES 6
+
+typedef struct TailKey {
+    uint32_t hash;
+    uint32_t blk;
+} TailKey;
+
+static int tail_key_cmp(const void* _a, const void* _b) {
+    const TailKey* a = (const TailKey*)_a;
+    const TailKey* b = (const TailKey*)_b;
+    if (a->hash != b->hash) return (a->hash < b->hash) ? -1 : 1;
+    return (a->blk < b->blk) ? -1 : (a->blk > b->blk);
+}
+
+// the last n instructions and the terminators of both blocks are the same
+static bool same_tail(const quosiIrBlock* a, const quosiIrBlock* b, size_t n) {
+    const size_t na = quosids_arrlenu(a->code);
+    const size_t nb = quosids_arrlenu(b->code);
+    if (na < n || nb < n || !quosi_ir_same_term(&a->term, &b->term)) return false;
+    for (size_t i = 1; i <= n; i++) {
+        if (!quosi_ir_same_instr(&a->code[na-i], &b->code[nb-i])) return false;
+    }
+    return true;
+}
+
+// sorts the live blocks by the hash of their last tail instructions and terminator, and splits
+// each run of equal hashes into classes of equal tails. tail SIZE_MAX compares whole blocks
+static uint32_t* tail_classes(quosiIrFunc* fn, const bool* live, size_t tail, uint32_t** bounds) {
+    TailKey* keys = NULL;
+    for (uint32_t i = 0; i < (uint32_t)quosids_arrlenu(fn->blocks); i++) {
+        const size_t n = quosids_arrlenu(fn->blocks[i].code);
+        if (!live[i] || (tail != SIZE_MAX && n < tail)) continue;
+        quosids_arrpush(keys, ((TailKey){ quosi_ir_tail_hash(&fn->blocks[i], (tail == SIZE_MAX) ? 0 : n - tail), i }));
+    }
+    if (keys) qsort(keys, quosids_arrlenu(keys), sizeof(TailKey), tail_key_cmp);
+
+    uint32_t* members = NULL;
+    bool* taken = NULL;
+    quosids_arraddn(taken, quosids_arrlenu(keys));
+    memset(taken, 0, quosids_arrlenu(keys) * sizeof(bool));
+    for (size_t i = 0; i < quosids_arrlenu(keys); ) {
+        size_t end = i;
+        while (end < quosids_arrlenu(keys) && keys[end].hash == keys[i].hash) end++;
+        for (size_t j = i; j < end; j++) {
+            if (taken[j]) continue;
+            const quosiIrBlock* lead = &fn->blocks[keys[j].blk];
+            const size_t n = quosids_arrlenu(lead->code);
+            quosids_arrpush(*bounds, (uint32_t)quosids_arrlenu(members));
+            for (size_t k = j; k < end; k++) {
+                const quosiIrBlock* blk = &fn->blocks[keys[k].blk];
+                if (taken[k]) continue;
+                if (tail == SIZE_MAX && quosids_arrlenu(blk->code) != n) continue;
+                if (k == j || same_tail(lead, blk, (tail == SIZE_MAX) ? n : tail)) {
+                    taken[k] = true;
+                    quosids_arrpush(members, keys[k].blk);
+                }
+            }
+        }
+        i = end;
+    }
+    quosids_arrpush(*bounds, (uint32_t)quosids_arrlenu(members));
+    quosids_arrfree(keys);
+    quosids_arrfree(taken);
+    return members;
+}
+
+// successors that are copies of another block go to that block instead. entry blocks are
+// never replaced, but stand in for their copies
+static bool merge_identical(quosiIrFunc* fn, const bool* live) {
+    const size_t nblocks = quosids_arrlenu(fn->blocks);
+    uint32_t* bounds = NULL;
+    uint32_t* members = tail_classes(fn, live, SIZE_MAX, &bounds);
+    uint32_t* canon = NULL;
+    quosids_arraddn(canon, nblocks);
+    memset(canon, 0xFF, nblocks * sizeof(uint32_t));
+    for (size_t c = 0; c + 1 < quosids_arrlenu(bounds); c++) {
+        uint32_t rep = members[bounds[c]];
+        for (uint32_t k = bounds[c]; k < bounds[c+1]; k++) {
+            if (fn->blocks[members[k]].entry) { rep = members[k]; break; }
+        }
+        for (uint32_t k = bounds[c]; k < bounds[c+1]; k++) {
+            if (members[k] != rep && !fn->blocks[members[k]].entry) canon[members[k]] = rep;
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < nblocks; i++) {
+        quosiIrTerm* t = &fn->blocks[i].term;
+        if (!live[i]) continue;
+        for (uint32_t j = 0; j < quosi_ir_succ_count(t); j++) {
+            uint32_t* slot = quosi_ir_succ(t, j);
+            if (*slot != QUOSI_IR_EXIT && canon[*slot] != UINT32_MAX) {
+                *slot = canon[*slot];
+                changed = true;
+            }
+        }
+    }
+    quosids_arrfree(bounds);
+    quosids_arrfree(members);
+    quosids_arrfree(canon);
+    return changed;
+}
+
+static void drop_term(quosiIrFunc* fn, quosiIrTerm* t) {
+    quosids_arrfree(t->targets);
+    quosids_arrfree(t->probs);
+    *t = (quosiIrTerm){ .kind=QUOSI_IR_TERM_JUMP };
+}
+
+// blocks ending in the same instructions and terminator keep only the part before, and jump
+// to one copy of the rest. the copy is laid out behind the last of them, which falls into it
+static void merge_tails(quosiIrFunc* fn, const bool* live) {
+    const size_t nblocks = quosids_arrlenu(fn->blocks);
+    uint32_t* bounds = NULL;
+    uint32_t* members = tail_classes(fn, live, 1, &bounds);
+    uint32_t* pos = NULL;
+    uint32_t* behind = NULL;
+    quosids_arraddn(pos, nblocks);
+    quosids_arraddn(behind, nblocks);
+    memset(pos, 0xFF, nblocks * sizeof(uint32_t));
+    memset(behind, 0xFF, nblocks * sizeof(uint32_t));
+    for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+        pos[fn->layout[i]] = (uint32_t)i;
+    }
+
+    for (size_t c = 0; c + 1 < quosids_arrlenu(bounds); c++) {
+        const uint32_t* m = members + bounds[c];
+        const uint32_t count = bounds[c+1] - bounds[c];
+        if (count < 2) continue;
+        size_t tail = SIZE_MAX;
+        uint32_t last = m[0];
+        for (uint32_t k = 0; k < count; k++) {
+            const size_t n = quosids_arrlenu(fn->blocks[m[k]].code);
+            if (n < tail) tail = n;
+            if (pos[m[k]] == UINT32_MAX) tail = 0;
+            else if (pos[m[k]] > pos[last]) last = m[k];
+        }
+        for (uint32_t k = 1; k < count; k++) {
+            while (tail > 0 && !same_tail(&fn->blocks[m[0]], &fn->blocks[m[k]], tail)) tail--;
+        }
+        uint32_t bytes = 0;
+        const quosiIrBlock* lead = &fn->blocks[m[0]];
+        for (size_t i = quosids_arrlenu(lead->code) - tail; i < quosids_arrlenu(lead->code); i++) {
+            bytes += quosi_ir_instr_size(&lead->code[i]);
+        }
+        if (bytes < TAIL_MIN_BYTES) continue;
+
+        // a member that is all tail is the copy, otherwise a fresh block takes the last one's
+        uint32_t copy = UINT32_MAX;
+        for (uint32_t k = 0; k < count; k++) {
+            if (quosids_arrlenu(fn->blocks[m[k]].code) == tail && !fn->blocks[m[k]].entry) copy = m[k];
+        }
+        if (copy == UINT32_MAX) {
+            copy = quosi_ir_block(fn);
+            quosiIrBlock* src = &fn->blocks[last];
+            const size_t n = quosids_arrlenu(src->code);
+            for (size_t i = n - tail; i < n; i++) {
+                quosids_arrpush(fn->blocks[copy].code, src->code[i]);
+            }
+            fn->blocks[copy].term = src->term;
+            src->term = (quosiIrTerm){ .kind=QUOSI_IR_TERM_JUMP };
+            behind[last] = copy;
+        }
+        for (uint32_t k = 0; k < count; k++) {
+            quosiIrBlock* blk = &fn->blocks[m[k]];
+            if (m[k] == copy) continue;
+            quosids_header(blk->code)->len -= tail;
+            drop_term(fn, &blk->term);
+            blk->term.target = copy;
+        }
+    }
+
+    uint32_t* order = NULL;
+    for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+        quosids_arrpush(order, fn->layout[i]);
+        if (behind[fn->layout[i]] != UINT32_MAX) quosids_arrpush(order, behind[fn->layout[i]]);
+    }
+    quosids_arrfree(fn->layout);
+    fn->layout = order;
+
+    quosids_arrfree(bounds);
+    quosids_arrfree(members);
+    quosids_arrfree(pos);
+    quosids_arrfree(behind);
+}
+
+void quosi_ir_pass_merge(quosiIrFunc* fn) {
+    bool* live = NULL;
+    uint32_t* preds = NULL;
+    quosids_arraddn(live, quosids_arrlenu(fn->blocks));
+    quosids_arraddn(preds, quosids_arrlenu(fn->blocks));
+
+    // blocks that jumped to copies may be copies of each other now
+    reach(fn, live, preds);
+    while (merge_identical(fn, live)) {
+        reach(fn, live, preds);
+    }
+    merge_tails(fn, live);
+
+    // merge_tails may have added blocks
+    quosids_arrfree(live);
+    quosids_arrfree(preds);
+    quosids_arraddn(live, quosids_arrlenu(fn->blocks));
+    quosids_arraddn(preds, quosids_arrlenu(fn->blocks));
+    reach(fn, live, preds);
+    size_t n = 0;
+    for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+        if (live[fn->layout[i]]) {
+            fn->layout[n++] = fn->layout[i];
+        }
+    }
+    quosids_header(fn->layout)->len = n;
+
+    quosids_arrfree(live);
+    quosids_arrfree(preds);
+}
+
+
+// follows a chain of empty blocks that only jump on, bounded so a cycle of them cannot hang
+static uint32_t thread_target(const quosiIrFunc* fn, uint32_t s) {
+    for (size_t hops = 0; s != QUOSI_IR_EXIT && hops < quosids_arrlenu(fn->blocks); hops++) {
+        const quosiIrBlock* blk = &fn->blocks[s];
+        if (quosids_arrlenu(blk->code) != 0 || blk->term.kind != QUOSI_IR_TERM_JUMP) break;
+        s = blk->term.target;
+    }
+    return s;
+}
+
+void quosi_ir_pass_thread(quosiIrFunc* fn) {
+    const size_t nblocks = quosids_arrlenu(fn->blocks);
+    bool* live = NULL;
+    uint32_t* preds = NULL;
+    quosids_arraddn(live, nblocks);
+    quosids_arraddn(preds, nblocks);
+
+    // edges into jump chains go straight to the end of the chain
+    reach(fn, live, preds);
+    for (size_t i = 0; i < nblocks; i++) {
+        quosiIrBlock* blk = &fn->blocks[i];
+        if (!live[i]) continue;
+        for (uint32_t j = 0; j < quosi_ir_succ_count(&blk->term); j++) {
+            uint32_t* slot = quosi_ir_succ(&blk->term, j);
+            *slot = thread_target(fn, *slot);
+        }
+        if (blk->term.kind == QUOSI_IR_TERM_BRANCH && blk->term.target == blk->term.next) {
+            // both ways lead to the same place, the condition is dropped unread
+            quosids_arrpush(blk->code, ((quosiIrInstr){ .op=QUOSI_INSTR_POP }));
+            blk->term = (quosiIrTerm){ .kind=QUOSI_IR_TERM_JUMP, .target=blk->term.target };
+        }
+    }
+
+    // each entry block and the blocks laid out behind it up to the next entry move as a unit.
+    // a unit only ever jumped to from the end of another is laid out right behind it, which
+    // inlines the vertex into its caller while the vertex table can still enter it
+    reach(fn, live, preds);
+    const size_t n = quosids_arrlenu(fn->layout);
+    uint32_t* order = NULL;
+    uint32_t* unit_of = NULL;
+    uint32_t* heads = NULL;
+    bool* placed = NULL;
+    quosids_arraddn(unit_of, nblocks);
+    memset(unit_of, 0xFF, nblocks * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t b = fn->layout[i];
+        if (!live[b]) continue;
+        if (fn->blocks[b].entry || quosids_arrlenu(heads) == 0) {
+            quosids_arrpush(heads, (uint32_t)i);
+        }
+        unit_of[b] = (uint32_t)quosids_arrlenu(heads) - 1;
+    }
+    quosids_arraddn(placed, quosids_arrlenu(heads));
+    memset(placed, 0, quosids_arrlenu(heads) * sizeof(bool));
+    for (uint32_t u = 0; u < (uint32_t)quosids_arrlenu(heads); u++) {
+        uint32_t unit = u;
+        while (unit != UINT32_MAX && !placed[unit]) {
+            placed[unit] = true;
+            uint32_t last = QUOSI_IR_EXIT;
+            for (size_t i = heads[unit]; i < n; i++) {
+                const uint32_t b = fn->layout[i];
+                if (!live[b]) continue;
+                if (unit_of[b] != unit) break;
+                quosids_arrpush(order, b);
+                last = b;
+            }
+            const quosiIrTerm* t = &fn->blocks[last].term;
+            unit = UINT32_MAX;
+            if (t->kind == QUOSI_IR_TERM_JUMP && t->target != QUOSI_IR_EXIT && preds[t->target] == 1) {
+                const uint32_t next = unit_of[t->target];
+                if (next != UINT32_MAX && fn->layout[heads[next]] == t->target) unit = next;
+            }
+        }
+    }
+    quosids_arrfree(fn->layout);
+    fn->layout = order;
+
+    quosids_arrfree(live);
+    quosids_arrfree(preds);
+    quosids_arrfree(unit_of);
+    quosids_arrfree(heads);
+    quosids_arrfree(placed);
+}
+
+
+// the host runs between these and may change any value behind a key
+static bool yields_to_host(uint8_t op) {
+    switch (op) {
+    case QUOSI_INSTR_LINE: case QUOSI_INSTR_LINET: case QUOSI_INSTR_PICK:
+    case QUOSI_INSTR_EVENT: case QUOSI_INSTR_CALL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+typedef struct KnownKey {
+    uint32_t key;
+    // LOAD or STORE that last put the value of key on the stack
+    size_t provider;
+} KnownKey;
+
+// a LOAD of a key whose value an earlier LOAD or STORE of the same straight line had on the
+// stack reads it back from a temporary instead. providers save into the temporary of their key
+static bool rewrite_loads(quosiIrFunc* fn, quosiIrBlock* blk) {
+    const size_t n = quosids_arrlenu(blk->code);
+    KnownKey* known = NULL;
+    // temporary of each key, by index
+    uint32_t* temps = NULL;
+    // per instruction, temp a provider saves into, 0xFF for none
+    uint8_t* save = NULL;
+    // per instruction, temp a redundant LOAD reads instead, 0xFF for none
+    uint8_t* reuse = NULL;
+    quosids_arraddn(save, n);
+    quosids_arraddn(reuse, n);
+    memset(save, 0xFF, n);
+    memset(reuse, 0xFF, n);
+    bool changed = false;
+
+    for (size_t i = 0; i < n; i++) {
+        const quosiIrInstr* in = &blk->code[i];
+        if (yields_to_host(in->op)) {
+            if (known) quosids_header(known)->len = 0;
+            continue;
+        }
+        if (in->op != QUOSI_INSTR_LOAD && in->op != QUOSI_INSTR_STORE) continue;
+        KnownKey* k = NULL;
+        for (size_t j = 0; j < quosids_arrlenu(known); j++) {
+            if (known[j].key == in->a) k = &known[j];
+        }
+        if (k == NULL) {
+            quosids_arrpush(known, ((KnownKey){ in->a, i }));
+        } else if (in->op == QUOSI_INSTR_STORE) {
+            k->provider = i;
+        } else {
+            size_t temp = 0;
+            while (temp < quosids_arrlenu(temps) && temps[temp] != in->a) temp++;
+            if (temp == quosids_arrlenu(temps)) {
+                // out of temporaries, the key is fetched as before
+                if (temp == QUOSI_TEMP_REGISTER_COUNT) continue;
+                quosids_arrpush(temps, in->a);
+            }
+            save[k->provider] = (uint8_t)temp;
+            reuse[i] = (uint8_t)temp;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        quosiIrInstr* code = NULL;
+        for (size_t i = 0; i < n; i++) {
+            const quosiIrInstr in = blk->code[i];
+            if (reuse[i] != 0xFF) {
+                quosids_arrpush(code, ((quosiIrInstr){ .op=QUOSI_INSTR_TLOAD, .a=reuse[i] }));
+            } else if (save[i] != 0xFF && in.op == QUOSI_INSTR_STORE) {
+                // saved before the STORE pops it
+                quosids_arrpush(code, ((quosiIrInstr){ .op=QUOSI_INSTR_TSAVE, .a=save[i] }));
+                quosids_arrpush(code, in);
+            } else if (save[i] != 0xFF) {
+                quosids_arrpush(code, in);
+                quosids_arrpush(code, ((quosiIrInstr){ .op=QUOSI_INSTR_TSAVE, .a=save[i] }));
+            } else {
+                quosids_arrpush(code, in);
+            }
+        }
+        quosids_arrfree(blk->code);
+        blk->code = code;
+    }
+    quosids_arrfree(known);
+    quosids_arrfree(temps);
+    quosids_arrfree(save);
+    quosids_arrfree(reuse);
+    return changed;
+}
+
+void quosi_ir_pass_loads(quosiIrFunc* fn) {
+    for (size_t i = 0; i < quosids_arrlenu(fn->layout); i++) {
+        rewrite_loads(fn, &fn->blocks[fn->layout[i]]);
+    }
+}
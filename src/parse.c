@@ -17,13 +17,18 @@ static void parse_vert(quosiParseCtx* ctx, quosiVertex* result);
 static void parse_vert_if(quosiParseCtx* ctx, quosiVertexIfElse* result);
 static void parse_vert_if_body(quosiParseCtx* ctx, quosiVertexBlock* result);
 static void parse_vert_match(quosiParseCtx* ctx, quosiVertexMatch* result);
+static void parse_vert_random(quosiParseCtx* ctx, quosiVertexRandom* result);
+static void parse_vert_import(quosiParseCtx* ctx, quosiVertexImport* result);
+static void parse_ident_list(quosiParseCtx* ctx, quosiStrView** result, bool edges);
 static void parse_edge(quosiParseCtx* ctx, quosiEdge* result);
 static void parse_edge_if(quosiParseCtx* ctx, quosiEdgeIfElse* result);
 static void parse_edge_if_body(quosiParseCtx* ctx, quosiEdgeBlock** result, bool top);
 static void parse_edge_match(quosiParseCtx* ctx, quosiEdgeMatch* result);
 static void parse_effect(quosiParseCtx* ctx, quosiEffect** result);
-
-// #define contains_key(map, key) (map.find(key) != map.end())
+static void parse_constant(quosiParseCtx* ctx, quosiToken kind, quosiConstant** result);
+static uint64_t parse_number(quosiToken n);
+static bool valid_utf8(quosiStrView str);
+static void warn_unreachable(quosiParseCtx* ctx, const quosiGraph* graph);
 
 
 quosiAst quosi_ast_parse_from_src(const char* src, quosiError* errors, quosiAllocator alloc) {
@@ -32,27 +37,71 @@ quosiAst quosi_ast_parse_from_src(const char* src, quosiError* errors, quosiAllo
         .tokens=quosi_token_stream_init(src),
         .errors=errors,
         .edges=NULL,
+        .names=NULL,
+        .imports=NULL,
+        .vertex={ NULL, 0 },
     };
     quosiParseCtx* ctx = &context;
     quosiAst result;
+    result.src = src;
     result.modules = NULL;
+    result.constants = NULL;
 
     quosiToken n = TNEXT(&ctx->tokens);
     while (n.type != QUOSI_TOKEN_EOF) {
-        // module NAME
         EH_CHECK_RET(n, KEYWORD, BAD_GRAPH_BEGIN);
+        if (STREQ(n.value, "const") || STREQ(n.value, "enum")) {
+            parse_constant(ctx, n, &result.constants);
+            EH_PROP_RET();
+            n = TNEXT(&ctx->tokens);
+            continue;
+        }
+        // module NAME [(EXIT, ...)]
         if (!STREQ(n.value, "module")) EH_FAIL_RET(n, BAD_GRAPH_BEGIN);
         const quosiToken name = TNEXT(&ctx->tokens);
         EH_CHECK_RET(name, IDENT, BAD_GRAPH_BEGIN);
 
         quosiGraph* graph = quosids_arraddnptr(result.modules, 1);
         graph->name = name.value;
+        graph->params = NULL;
         graph->vertices = NULL;
+        graph->constants = NULL;
+        graph->index = NULL;
+        if (TPEEK(&ctx->tokens).type == QUOSI_TOKEN_OPENPAREN) {
+            parse_ident_list(ctx, &graph->params, false);
+            EH_PROP_RET();
+            for (uint32_t i = 0; i < (uint32_t)quosids_arrlenu(graph->params); i++) {
+                if (!quosi_graph_index(graph, i, true, ctx->alloc)) EH_FAIL_RET(name, DUPLICATE_VERTEX);
+            }
+        }
+        if (ctx->names) quosids_header(ctx->names)->len = 0;
+        if (ctx->edges) quosids_header(ctx->edges)->len = 0;
         parse_graph(ctx, graph);
         EH_PROP_RET();
+        warn_unreachable(ctx, graph);
         n = TNEXT(&ctx->tokens);
     }
+
+    // imports may name modules further down the file
+    for (size_t i = 0; i < quosids_arrlenu(context.imports); i++) {
+        const quosiImportRef* imp = &context.imports[i];
+        const quosiGraph* mod = NULL;
+        for (size_t j = 0; j < quosids_arrlenu(result.modules); j++) {
+            const quosiStrView name = result.modules[j].name;
+            if (name.len == imp->module.value.len && strncmp(name.ptr, imp->module.value.ptr, name.len) == 0) {
+                mod = &result.modules[j];
+                break;
+            }
+        }
+        if (mod == NULL) {
+            EH_FAIL_RET(imp->module, UNKNOWN_MODULE);
+        } else if (quosids_arrlenu(mod->params) != imp->arity) {
+            EH_FAIL_RET(imp->module, BAD_IMPORT);
+        }
+    }
     quosids_arrfree(context.edges);
+    quosids_arrfree(context.names);
+    quosids_arrfree(context.imports);
 
     return result;
 }
@@ -63,7 +112,12 @@ static void parse_graph(quosiParseCtx* ctx, quosiGraph* result) {
         // rename INIT => NEW
         if (n.type == QUOSI_TOKEN_KEYWORD) {
             if (STREQ(n.value, "endmod")) {
-                return;
+                break;
+            } else if (STREQ(n.value, "const") || STREQ(n.value, "enum")) {
+                parse_constant(ctx, n, &result->constants);
+                EH_PROP();
+                n = TNEXT(&ctx->tokens);
+                continue;
             } else if (!STREQ(n.value, "rename")) {
                 EH_FAIL(n, BAD_VERTEX_BEGIN);
             }
@@ -82,25 +136,35 @@ static void parse_graph(quosiParseCtx* ctx, quosiGraph* result) {
         const quosiToken name = n;
         n = TNEXT(&ctx->tokens);
         EH_CHECK(n, SETEQ, MISPLACED_TOKEN);
+        ctx->vertex = name.value;
+        quosids_arrpush(ctx->names, name);
 
         quosids_arrpush(result->vertices, ((quosiNamedVertex){ name.value, { 0 } }));
         quosiVertexBlock* vert = &quosids_arrlast(result->vertices).data;
-        // if (contains_key(result.vert_names, vert.first)) EH_FAIL(name, DUPLICATE_VERTEX);
+        if (!quosi_graph_index(result, (uint32_t)quosids_arrlenu(result->vertices) - 1, false, ctx->alloc)) EH_FAIL(name, DUPLICATE_VERTEX);
         parse_vert_if_body(ctx, vert);
         EH_PROP();
         n = TNEXT(&ctx->tokens);
     }
 
-    // if (!contains_key(result.vert_names, "START")) EH_FAIL(n, NO_ENTRY);
-    // for (const auto& edge : ctx.edges) {
-    //     if (STREQ(edge.value, "START") || STREQ(edge.value, "EXIT")) continue;
-    //     const auto e = edge.value;
-    //     if (!contains_key(result.vert_names, e)) {
-    //          EH_FAIL(edge, DANGLING_EDGE);
-    //     }
-    // }
+    if (n.type == QUOSI_TOKEN_EOF) EH_FAIL(n, EARLY_EOF);
 
-    EH_FAIL(n, EARLY_EOF);
+    if (quosi_graph_find(result, (quosiStrView){ "START", 5 }) >= quosids_arrlenu(result->vertices)) EH_FAIL(n, NO_ENTRY);
+    for (size_t i = 0; i < quosids_arrlenu(ctx->edges); i++) {
+        const quosiToken edge = ctx->edges[i];
+        if (!STREQ(edge.value, "EXIT") && quosi_graph_find(result, edge.value) == UINT32_MAX) EH_FAIL(edge, DANGLING_EDGE);
+    }
+}
+
+// codegen leaves these vertices out, the author should hear about it
+static void warn_unreachable(quosiParseCtx* ctx, const quosiGraph* graph) {
+    bool* live = NULL;
+    quosids_arraddn(live, quosids_arrlenu(graph->vertices));
+    quosi_graph_reachable(graph, live, ctx->alloc);
+    for (size_t i = 0; i < quosids_arrlenu(graph->vertices); i++) {
+        if (!live[i]) quosi_internal_error_handle(ctx->errors, ctx->names[i], QUOSI_ERR_UNREACHABLE_VERTEX);
+    }
+    quosids_arrfree(live);
 }
 
 static void parse_vert(quosiParseCtx* ctx, quosiVertex* result) {
@@ -119,6 +183,7 @@ static void parse_vert(quosiParseCtx* ctx, quosiVertex* result) {
         n = TNEXT(&ctx->tokens);
         while (n.type != QUOSI_TOKEN_GTH) {
             EH_CHECK(n, STRLIT, UNKNOWN);
+            if (!valid_utf8(n.value)) EH_FAIL(n, INVALID_UTF8);
             quosids_arrpush(lines->lines, n.value);
             n = TNEXT(&ctx->tokens);
             switch (n.type) {
@@ -225,6 +290,14 @@ static void parse_vert_if_body(quosiParseCtx* ctx, quosiVertexBlock* result) {
             result->tag = QUOSI_VBLOCK_IFELSE;
             result->value.ifelse.blocks = NULL;
             parse_vert_if(ctx, &result->value.ifelse);
+        } else if (STREQ(n.value, "random")) {
+            result->tag = QUOSI_VBLOCK_RANDOM;
+            result->value.random.arms = NULL;
+            parse_vert_random(ctx, &result->value.random);
+        } else if (STREQ(n.value, "import")) {
+            result->tag = QUOSI_VBLOCK_IMPORT;
+            result->value.import.exits = NULL;
+            parse_vert_import(ctx, &result->value.import);
         }
         break;
     case QUOSI_TOKEN_LTH:
@@ -294,10 +367,53 @@ static void parse_vert_match(quosiParseCtx* ctx, quosiVertexMatch* result) {
     EH_FAIL(n, EARLY_EOF);
 }
 
+static void parse_vert_random(quosiParseCtx* ctx, quosiVertexRandom* result) {
+    quosiToken n = TNEXT(&ctx->tokens);
+
+    // random with
+    n = TNEXT(&ctx->tokens);
+    EH_CHECK(n, KEYWORD, UNKNOWN);
+    if (!STREQ(n.value, "with")) EH_FAIL(n, UNKNOWN);
+
+    n = TNEXT(&ctx->tokens);
+    while (n.type != QUOSI_TOKEN_EOF) {
+        switch (n.type) {
+        case QUOSI_TOKEN_KEYWORD:
+            if (!STREQ(n.value, "end"))     EH_FAIL(n, UNCLOSED_CONDITIONAL);
+            if (result->arms == NULL)       EH_FAIL(n, BAD_MATCH_ARM);
+            return;
+
+        case QUOSI_TOKEN_OPENPAREN: {
+            // (WEIGHT) VERTEX
+            quosiVertexRandomArm* arm = quosids_arraddnptr(result->arms, 1);
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, NUMBER, INVALID_WEIGHT);
+            arm->weight = parse_number(n);
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, CLOSEPAREN, UNCLOSED_PAREN);
+            n = TPEEK(&ctx->tokens);
+            EH_CHECK(n, LTH, UNKNOWN);
+            arm->body.lineset = NULL;
+            arm->body.v.edges = NULL;
+            parse_vert(ctx, &arm->body);
+            EH_PROP();
+            break; }
+
+        default:
+            EH_FAIL(n, BAD_MATCH_ARM);
+            break;
+        }
+        n = TNEXT(&ctx->tokens);
+    }
+
+    EH_FAIL(n, EARLY_EOF);
+}
+
 static void parse_edge(quosiParseCtx* ctx, quosiEdge* result) {
     // STRING :: (EFFECT) => IDENT
     quosiToken n = TNEXT(&ctx->tokens);
     EH_CHECK(n, STRLIT, UNKNOWN);
+    if (!valid_utf8(n.value)) EH_FAIL(n, INVALID_UTF8);
     result->line = n.value;
     n = TNEXT(&ctx->tokens);
     switch (n.type) {
@@ -521,3 +637,129 @@ static void parse_effect(quosiParseCtx* ctx, quosiEffect** result) {
     }
 }
 
+
+static void parse_ident_list(quosiParseCtx* ctx, quosiStrView** result, bool edges) {
+    // (IDENT, ...)
+    quosiToken n = TNEXT(&ctx->tokens);
+    EH_CHECK(n, OPENPAREN, UNKNOWN);
+    n = TNEXT(&ctx->tokens);
+    while (n.type != QUOSI_TOKEN_CLOSEPAREN) {
+        EH_CHECK(n, IDENT, UNKNOWN);
+        quosids_arrpush(*result, n.value);
+        if (edges) quosids_arrpush(ctx->edges, n);
+        n = TNEXT(&ctx->tokens);
+        if (n.type == QUOSI_TOKEN_COMMA) {
+            n = TNEXT(&ctx->tokens);
+        } else {
+            EH_CHECK(n, CLOSEPAREN, UNCLOSED_PAREN);
+        }
+    }
+}
+static void parse_vert_import(quosiParseCtx* ctx, quosiVertexImport* result) {
+    // import MODULE(VERTEX, ...)
+    TNEXT(&ctx->tokens);
+    const quosiToken mod = TNEXT(&ctx->tokens);
+    EH_CHECK(mod, IDENT, UNKNOWN);
+    result->module = mod.value;
+    parse_ident_list(ctx, &result->exits, true);
+    EH_PROP();
+    quosids_arrpush(ctx->imports, ((quosiImportRef){ mod, quosids_arrlenu(result->exits) }));
+}
+
+
+// rejects overlong forms, surrogates and code points past U+10FFFF
+static bool valid_utf8(quosiStrView str) {
+    const uint8_t* s = (const uint8_t*)str.ptr;
+    size_t i = 0;
+    while (i < str.len) {
+        const uint8_t c = s[i];
+        size_t n;
+        uint32_t cp;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if ((c & 0xE0) == 0xC0) {
+            n = 1; cp = c & 0x1F;
+        } else if ((c & 0xF0) == 0xE0) {
+            n = 2; cp = c & 0x0F;
+        } else if ((c & 0xF8) == 0xF0) {
+            n = 3; cp = c & 0x07;
+        } else {
+            return false;
+        }
+        if (i + n >= str.len) return false;
+        for (size_t k = 1; k <= n; k++) {
+            if ((s[i+k] & 0xC0) != 0x80) return false;
+            cp = (cp << 6) | (s[i+k] & 0x3F);
+        }
+        if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000)) return false;
+        if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) return false;
+        i += n + 1;
+    }
+    return true;
+}
+
+static bool constant_eq(const quosiConstant* a, const quosiConstant* b) {
+    return (a->scope.len == b->scope.len) && (strncmp(a->scope.ptr, b->scope.ptr, a->scope.len) == 0) &&
+           (a->name.len  == b->name.len)  && (strncmp(a->name.ptr,  b->name.ptr,  a->name.len)  == 0);
+}
+static void push_constant(quosiParseCtx* ctx, quosiConstant** result, quosiToken name, quosiConstant c) {
+    for (size_t i = 0; i < quosids_arrlenu(*result); i++) {
+        if (constant_eq(&(*result)[i], &c)) {
+            EH_FAIL(name, DUPLICATE_CONSTANT);
+            return;
+        }
+    }
+    quosids_arrpush(*result, c);
+}
+static uint64_t parse_number(quosiToken n) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < n.value.len; i++) {
+        result = (10 * result) + (uint64_t)(n.value.ptr[i] - '0');
+    }
+    return result;
+}
+static void parse_constant(quosiParseCtx* ctx, quosiToken kind, quosiConstant** result) {
+    quosiToken n;
+    if (STREQ(kind.value, "const")) {
+        // const IDENT = NUMBER
+        const quosiToken name = TNEXT(&ctx->tokens);
+        EH_CHECK(name, IDENT, BAD_CONSTANT);
+        n = TNEXT(&ctx->tokens);
+        EH_CHECK(n, SETEQ, BAD_CONSTANT);
+        n = TNEXT(&ctx->tokens);
+        EH_CHECK(n, NUMBER, BAD_CONSTANT);
+        push_constant(ctx, result, name, (quosiConstant){ { NULL, 0 }, name.value, parse_number(n) });
+        return;
+    }
+
+    // enum [IDENT] { IDENT [= NUMBER], ... }
+    quosiStrView scope = { NULL, 0 };
+    n = TNEXT(&ctx->tokens);
+    if (n.type == QUOSI_TOKEN_IDENT) {
+        scope = n.value;
+        n = TNEXT(&ctx->tokens);
+    }
+    EH_CHECK(n, OPENBRACE, BAD_CONSTANT);
+
+    uint64_t next = 0;
+    n = TNEXT(&ctx->tokens);
+    while (n.type != QUOSI_TOKEN_CLOSEBRACE) {
+        EH_CHECK(n, IDENT, BAD_CONSTANT);
+        const quosiToken name = n;
+        n = TNEXT(&ctx->tokens);
+        if (n.type == QUOSI_TOKEN_SETEQ) {
+            n = TNEXT(&ctx->tokens);
+            EH_CHECK(n, NUMBER, BAD_CONSTANT);
+            next = parse_number(n);
+            n = TNEXT(&ctx->tokens);
+        }
+        push_constant(ctx, result, name, (quosiConstant){ scope, name.value, next++ });
+        EH_PROP();
+        if (n.type == QUOSI_TOKEN_COMMA) {
+            n = TNEXT(&ctx->tokens);
+        } else {
+            EH_CHECK(n, CLOSEBRACE, BAD_CONSTANT);
+        }
+    }
+}
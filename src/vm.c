@@ -5,49 +5,168 @@
 #include <stdbool.h>
 
 
-typedef struct _InternalProp {
-    uint32_t pos;
-    uint8_t idx;
-} _InternalProp;
-static void _vm_enq_iprop(quosiVm* self, _InternalProp p) {
-    self->text[self->TH++] = (quosiProposition){ (const char*)self->strs + p.pos, p.idx };
+static quosiProposition* _vm_queue(quosiVm* self, uint32_t* cap) {
+    if (self->props) {
+        *cap = self->pcap;
+        return self->props;
+    }
+    *cap = QUOSI_PROP_QUEUE_SIZE;
+    return self->text;
+}
+// PROP str, idx [, tmpl]
+static bool _vm_enq_prop(quosiVm* self, bool tmpl) {
+    uint32_t pos, cap;
+    uint16_t idx;
+    uint32_t t = QUOSI_TEMPLATE_NONE;
+    memcpy(&pos, self->code + self->PC, sizeof(uint32_t));
+    self->PC += sizeof(uint32_t);
+    memcpy(&idx, self->code + self->PC, sizeof(uint16_t));
+    self->PC += sizeof(uint16_t);
+    if (tmpl) {
+        memcpy(&t, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+    }
+    quosiProposition* queue = _vm_queue(self, &cap);
+    if (self->TH == cap) return false;
+    queue[self->TH++] = (quosiProposition){ (const char*)self->strs + pos, idx, t };
+    return true;
+}
+static uint64_t _vm_rand(quosiVm* self) {
+    // splitmix64, any seed is a valid state
+    uint64_t z = (self->R += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
 }
 static int _vm_step(quosiVm* self, quosiVmCtx ctx);
+static int _vm_dispatch(quosiVm* self, quosiVmCtx ctx, uint8_t op);
 
 
 void quosi_vm_init(quosiVm* self, const quosiFile* file, const char* module) {
+    memset(self->visits, 0, sizeof(self->visits));
+    self->R  = 0x853C49E6748FEA9Bull;
+    self->natives  = NULL;
+    self->nnatives = 0;
+    self->props = NULL;
+    self->pcap  = 0;
+    self->profile  = NULL;
+    self->nprofile = 0;
+    quosi_vm_restart(self, file, module);
+}
+
+bool quosi_vm_init_at(quosiVm* self, const quosiFile* file, const char* module, const char* vertex) {
+    quosi_vm_init(self, file, module);
+    const uint32_t at = quosi_file_vertex(file, quosi_file_module_index(file, module), vertex);
+    if (at == UINT32_MAX) return false;
+    self->PC = at;
+    return true;
+}
+
+void quosi_vm_restart(quosiVm* self, const quosiFile* file, const char* module) {
     self->base = (const uint8_t*)file;
     quosiFileModTableEntry entry = quosi_file_module(file, module);
     self->code = entry.code;
     self->strs = quosi_file_strs(file);
+    self->tmpl = quosi_file_tmpl(file);
+    self->evts = quosi_file_evts(file);
     self->PC = entry.entry;
     self->SP = 0;
+    self->FP = 0;
     self->TH = 0;
     self->TT = 0;
     self->A  = 0;
     self->B  = 0;
+    self->C  = QUOSI_TEMPLATE_NONE;
+    self->D  = 0;
+    self->BK = 0;
+}
+
+void quosi_vm_seed(quosiVm* self, uint64_t seed) {
+    self->R = seed;
+}
+
+void quosi_vm_bind(quosiVm* self, const quosiVmNative* natives, uint32_t count) {
+    self->natives  = natives;
+    self->nnatives = count;
+}
+void quosi_vm_profile(quosiVm* self, uint32_t* counts, uint32_t len) {
+    self->profile  = counts;
+    self->nprofile = counts ? len : 0;
 }
 
 const char* quosi_vm_line(const quosiVm* self) { return (const char*)self->strs + self->B; }
+quosiStrView quosi_vm_line_view(const quosiVm* self) { return quosi_strview((const char*)self->strs + self->B); }
 uint32_t    quosi_vm_id(const quosiVm* self) { return self->A; }
 uint32_t    quosi_vm_nq(const quosiVm* self) { return self->B; }
+uint32_t    quosi_vm_line_id(const quosiVm* self) { return self->D; }
+uint32_t    quosi_vm_line_template(const quosiVm* self) { return self->C; }
+
+uint32_t quosi_vm_template_len(const quosiVm* self, uint32_t tmpl) {
+    uint32_t n;
+    memcpy(&n, self->tmpl + tmpl + sizeof(uint32_t), sizeof(uint32_t));
+    return n;
+}
+quosiTextSegment quosi_vm_template_segment(const quosiVm* self, uint32_t tmpl, uint32_t i) {
+    // str, nsegs, [key, off, len] * nsegs
+    uint32_t str, seg[3];
+    memcpy(&str, self->tmpl + tmpl, sizeof(uint32_t));
+    memcpy(seg, self->tmpl + tmpl + (2 + 3 * i) * sizeof(uint32_t), sizeof(seg));
+    return (quosiTextSegment){ (const char*)self->strs + str + seg[1], seg[2], seg[0] };
+}
 
 void             quosi_vm_push_value(quosiVm* self, uint64_t val) { self->stack[(self->SP)++] = val; }
 uint64_t         quosi_vm_pop_value(quosiVm* self)       { return self->stack[--(self->SP)]; }
 uint64_t         quosi_vm_top_value(const quosiVm* self) { return self->stack[self->SP-1]; }
-quosiProposition quosi_vm_dequeue_text(quosiVm* self)    { return self->text[(self->TT)++]; }
+quosiProposition quosi_vm_dequeue_text(quosiVm* self) {
+    uint32_t cap;
+    return _vm_queue(self, &cap)[(self->TT)++];
+}
+
+void quosi_vm_prop_buffer(quosiVm* self, quosiProposition* buffer, uint32_t cap) {
+    self->props = buffer;
+    self->pcap  = cap;
+}
+uint32_t quosi_vm_choice_len(const quosiVm* self) {
+    // PC rests on the SWITCH following PICK
+    uint32_t n;
+    memcpy(&n, self->code + self->PC + 1, sizeof(uint32_t));
+    return n;
+}
+void quosi_vm_prop_mask(const quosiVm* self, uint64_t* mask, uint32_t nwords) {
+    uint32_t cap;
+    const quosiProposition* queue = _vm_queue((quosiVm*)self, &cap);
+    memset(mask, 0, nwords * sizeof(uint64_t));
+    for (uint32_t i = 0; i < self->TH; i++) {
+        const uint32_t w = queue[i].idx / 64;
+        if (w < nwords) mask[w] |= (uint64_t)1 << (queue[i].idx % 64);
+    }
+}
 
 int quosi_vm_exec(quosiVm* self, quosiVmCtx ctx) {
-    self->TH = 0;
-    self->TT = 0;
-    int s = _vm_step(self, ctx);
+    int s;
+    if (self->BK) {
+        // resume with the instruction the breakpoint displaced, read from the pristine bytes
+        // behind the debug copy. propositions queued before the break are kept
+        self->BK = 0;
+        const quosiFile* file = (const quosiFile*)self->base;
+        const size_t at = (size_t)(self->code - quosi_file_code(file)) + self->PC - 1;
+        s = _vm_dispatch(self, ctx, self->base[quosi_file_len(file) + at]);
+    } else {
+        self->TH = 0;
+        self->TT = 0;
+        s = _vm_step(self, ctx);
+    }
     while (s == QUOSI_UPCALL_NONE) s = _vm_step(self, ctx);
     return s;
 }
 
 
 static int _vm_step(quosiVm* self, quosiVmCtx ctx) {
-    switch (self->code[self->PC++]) {
+    return _vm_dispatch(self, ctx, self->code[self->PC++]);
+}
+
+static int _vm_dispatch(quosiVm* self, quosiVmCtx ctx, uint8_t op) {
+    switch (op) {
     case QUOSI_INSTR_EOF:
         return QUOSI_UPCALL_EXIT;
 
@@ -63,6 +182,17 @@ static int _vm_step(quosiVm* self, quosiVmCtx ctx) {
         self->stack[self->SP++] = val;
         break; }
 
+    case QUOSI_INSTR_TSAVE: {
+        const uint8_t r = self->code[self->PC++];
+        if (r >= QUOSI_TEMP_REGISTER_COUNT) return QUOSI_UPCALL_ABORT;
+        self->T[r] = self->stack[self->SP-1];
+        break; }
+    case QUOSI_INSTR_TLOAD: {
+        const uint8_t r = self->code[self->PC++];
+        if (r >= QUOSI_TEMP_REGISTER_COUNT) return QUOSI_UPCALL_ABORT;
+        self->stack[self->SP++] = self->T[r];
+        break; }
+
     case QUOSI_INSTR_LOAD: {
         uint32_t k;
         memcpy(&k, self->code + self->PC, sizeof(uint32_t));
@@ -179,18 +309,92 @@ static int _vm_step(quosiVm* self, quosiVmCtx ctx) {
         }
         break;
     case QUOSI_INSTR_SWITCH: {
-        const uint32_t off = (uint32_t)self->stack[--self->SP] * sizeof(uint32_t);
-        memcpy(&self->PC, self->code + self->PC + off, sizeof(uint32_t));
-        if (self->PC == QUOSI_VERTEX_EXIT) return QUOSI_UPCALL_EXIT;
+        // SWITCH n, [target] * n, out of range indices fall through
+        uint32_t n;
+        memcpy(&n, self->code + self->PC, sizeof(uint32_t));
+        const uint64_t i = self->stack[--self->SP];
+        if (i < n) {
+            memcpy(&self->PC, self->code + self->PC + sizeof(uint32_t) + i * sizeof(uint32_t), sizeof(uint32_t));
+            if (self->PC == QUOSI_VERTEX_EXIT) return QUOSI_UPCALL_EXIT;
+        } else {
+            self->PC += (n + 1) * sizeof(uint32_t);
+        }
+        break; }
+    case QUOSI_INSTR_RAND: {
+        // RAND n, [prob, target, alias] * n
+        uint32_t n, col[3];
+        memcpy(&n, self->code + self->PC, sizeof(uint32_t));
+        const uint64_t r = _vm_rand(self);
+        const uint32_t i = (uint32_t)(((r >> 32) * n) >> 32);
+        memcpy(col, self->code + self->PC + sizeof(uint32_t) + i * sizeof(col), sizeof(col));
+        self->PC = ((uint32_t)r < col[0]) ? col[1] : col[2];
+        break; }
+
+    case QUOSI_INSTR_VISIT: {
+        uint32_t k;
+        memcpy(&k, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        if (k >= QUOSI_VISIT_COUNTER_SIZE) return QUOSI_UPCALL_ABORT;
+        if (self->visits[k] < UINT8_MAX) self->visits[k]++;
+        break; }
+    case QUOSI_INSTR_SEEN: {
+        uint32_t k;
+        memcpy(&k, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        if (k >= QUOSI_VISIT_COUNTER_SIZE) return QUOSI_UPCALL_ABORT;
+        self->stack[self->SP++] = self->visits[k];
+        break; }
+    case QUOSI_INSTR_PROBE: {
+        uint32_t k;
+        memcpy(&k, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        if (k < self->nprofile && self->profile[k] < UINT32_MAX) self->profile[k]++;
+        break; }
+
+    case QUOSI_INSTR_CALL: {
+        uint32_t fn;
+        uint8_t argc;
+        memcpy(&fn, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        memcpy(&argc, self->code + self->PC, sizeof(uint8_t));
+        self->PC += sizeof(uint8_t);
+        if (fn >= self->nnatives) return QUOSI_UPCALL_ABORT;
+        self->SP -= argc;
+        self->stack[self->SP] = self->natives[fn](self->stack + self->SP, argc);
+        self->SP++;
         break; }
 
-    case QUOSI_INSTR_PROP: {
-        _InternalProp p;
-        memcpy(&p, self->code + self->PC, sizeof(uint32_t) + sizeof(uint8_t));
-        self->PC += sizeof(uint32_t) + sizeof(uint8_t);
-        _vm_enq_iprop(self, p);
+    case QUOSI_INSTR_CALLM: {
+        // CALLM mod, n, [target] * n, the frame remembers the targets for RETX
+        uint32_t mod;
+        memcpy(&mod, self->code + self->PC, sizeof(uint32_t));
+        const quosiFileModTableEntry entry = quosi_file_module_by_index((const quosiFile*)self->base, mod);
+        if (entry.code == NULL || self->FP == QUOSI_CALL_STACK_SIZE) return QUOSI_UPCALL_ABORT;
+        self->frames[self->FP++] = (quosiVmFrame){ self->code, self->PC + (uint32_t)sizeof(uint32_t) };
+        self->code = entry.code;
+        self->PC = entry.entry;
+        break; }
+    case QUOSI_INSTR_RETX: {
+        uint32_t k, n;
+        memcpy(&k, self->code + self->PC, sizeof(uint32_t));
+        // a module entered directly has nowhere to return to
+        if (self->FP == 0) return QUOSI_UPCALL_EXIT;
+        const quosiVmFrame f = self->frames[--self->FP];
+        memcpy(&n, f.code + f.PC, sizeof(uint32_t));
+        if (k >= n) return QUOSI_UPCALL_ABORT;
+        self->code = f.code;
+        memcpy(&self->PC, f.code + f.PC + (1 + k) * sizeof(uint32_t), sizeof(uint32_t));
+        if (self->PC == QUOSI_VERTEX_EXIT) return QUOSI_UPCALL_EXIT;
         break; }
 
+    case QUOSI_INSTR_PROP:
+        // a full queue is an error, never a silently missing option
+        if (!_vm_enq_prop(self, false)) return QUOSI_UPCALL_ABORT;
+        break;
+    case QUOSI_INSTR_PROPT:
+        if (!_vm_enq_prop(self, true)) return QUOSI_UPCALL_ABORT;
+        break;
+
     case QUOSI_INSTR_PICK:
         self->B = self->TH;
         return QUOSI_UPCALL_PICK;
@@ -199,12 +403,32 @@ static int _vm_step(quosiVm* self, quosiVmCtx ctx) {
         self->PC += sizeof(uint32_t);
         memcpy(&self->B, self->code + self->PC, sizeof(uint32_t));
         self->PC += sizeof(uint32_t);
+        memcpy(&self->D, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        self->C = QUOSI_TEMPLATE_NONE;
         return QUOSI_UPCALL_LINE;
-    case QUOSI_INSTR_EVENT:
+    case QUOSI_INSTR_LINET:
+        memcpy(&self->A, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
         memcpy(&self->B, self->code + self->PC, sizeof(uint32_t));
         self->PC += sizeof(uint32_t);
+        memcpy(&self->D, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        memcpy(&self->C, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        return QUOSI_UPCALL_LINE;
+    case QUOSI_INSTR_EVENT:
+        // A = event ID, B = its name
+        memcpy(&self->A, self->code + self->PC, sizeof(uint32_t));
+        self->PC += sizeof(uint32_t);
+        memcpy(&self->B, self->evts + self->A * sizeof(uint32_t), sizeof(uint32_t));
         return QUOSI_UPCALL_EVENT;
+
+    case QUOSI_INSTR_BREAK:
+        // PC stays past the opcode, the displaced instruction reads its operands from there
+        self->BK = 1;
+        return QUOSI_UPCALL_BREAK;
     }
-    return (self->SP > 128) ? QUOSI_UPCALL_ABORT : QUOSI_UPCALL_NONE;
+    return (self->SP > QUOSI_VALUE_STACK_SIZE) ? QUOSI_UPCALL_ABORT : QUOSI_UPCALL_NONE;
 }
 
@@ -13,7 +13,7 @@
 
 
 static uint32_t dummy_ctxf(const char* key) { (void)key; return 0; }
-static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf };
+static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf, NULL };
 
 vango_test(bench_memory) {
     char* src = read_to_string("examples/large.qsi");
@@ -70,7 +70,7 @@ vango_test(bench_codegen) {
 
     vango_bench(10000, {
         quosi_memory_arena_reset(&cmp_arena);
-        file = quosi_file_compile_from_ast(&ast, dummy_ctx, quosi_memory_arena_allocator(&cmp_arena));
+        file = quosi_file_compile_from_ast(&ast, &errors, dummy_ctx, NULL, quosi_memory_arena_allocator(&cmp_arena));
     });
 
     vg_assert_non_null(file);
@@ -87,7 +87,7 @@ vango_test(bench_compiler) {
 
     vango_bench(10000, {
         quosi_memory_arena_reset(&arena);
-        file = quosi_file_compile_from_src(src, &errors, dummy_ctx, quosi_memory_arena_allocator(&arena));
+        file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_memory_arena_allocator(&arena));
     });
 
     vg_assert_non_null(file);
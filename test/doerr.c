@@ -2,16 +2,17 @@
 #define _GNU_SOURCE
 #include <vangotest/casserts2.h>
 #include "quosi/quosi.h"
+#include "quosi/vm.h"
 #include <stdlib.h>
-// #include <stdio.h>
+#include <stdio.h>
 
 
 static uint32_t dummy_ctxf(const char* key) { (void)key; return 0; }
-static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf };
+static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf, NULL };
 
 static void expect_single_fail(VANGO_TEST_PARAMS, int err, const char* src) {
     quosiError errors = { 0 };
-    free(quosi_file_compile_from_src(src, &errors, dummy_ctx, quosi_malloc_allocator()));
+    free(quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator()));
     vg_assert_non_null(errors.list);
     vg_assert_eq(err, errors.list[0].type);
     // printf("quosi compile error (%u:%u): %s\n", errors.list[0].span.row, errors.list[0].span.col, quosi_error_to_string(errors.list[0]));
@@ -54,3 +55,168 @@ vango_test(invalid_assign2) {
         "module Ass START = if (0:25) then <Brian: \"Hello there.\"> => EXIT else <Brian: \"Byebye.\"> => EXIT end endmod");
 }
 
+
+vango_test(invalid_weight) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_INVALID_WEIGHT,
+        "module Rand START = random with (a) <Brian: \"Hello there.\"> => EXIT end endmod");
+}
+
+vango_test(dangling_visits) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_DANGLING_EDGE,
+        "module Visits START = if (visits(Typo) > 0) then <Brian: \"Seen.\"> => EXIT else <Brian: \"New.\"> => EXIT end endmod");
+}
+
+vango_test(too_many_counters) {
+    // one more vertex tested with 'once' than the vm has counters
+    char* src = malloc(64 * 1024);
+    size_t len = (size_t)sprintf(src, "module Counters START = <Brian: \"Hi.\"> => v0 ");
+    for (int i = 0; i <= 256; i++) {
+        len += (size_t)sprintf(src + len, "v%d = if (once) then <Brian: \"Hi.\"> => v%d else <Brian: \"Bye.\"> => EXIT end ", i, i + 1);
+    }
+    sprintf(src + len, "v257 = <Brian: \"Bye.\"> => EXIT endmod");
+    expect_single_fail(_vango_test_result, QUOSI_ERR_TOO_MANY_COUNTERS, src);
+    free(src);
+}
+
+vango_test(unknown_function) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_UNKNOWN_FUNCTION,
+        "module Call START = if (roll(6) > 3) then <Brian: \"Lucky.\"> => EXIT else <Brian: \"Unlucky.\"> => EXIT end endmod");
+}
+
+// a condition calling sum with argc arguments, in the vertex after an effect of op
+static char* sum_call_src(int argc, const char* op) {
+    char* src = malloc(4 * 1024);
+    size_t len = (size_t)sprintf(src, "module Call START = <Brian: \"Hi.\"> :: (x %s sum(0", op);
+    for (int i = 1; i < argc; i++) len += (size_t)sprintf(src + len, ", 1");
+    sprintf(src + len, ")) => B  B = if (x > 3) then <Brian: \"Big.\"> => EXIT else <Brian: \"Small.\"> => EXIT end endmod");
+    return src;
+}
+
+static uint32_t sum_func(const char* name) { (void)name; return 0; }
+
+vango_test(too_many_arguments) {
+    const quosiSymbolCtx ctx = { dummy_ctxf, dummy_ctxf, sum_func };
+    quosiError errors = { 0 };
+    // every argument is still on the stack when the call runs, so the full stack is the most a call takes
+    char* src = sum_call_src(QUOSI_VALUE_STACK_SIZE, "=");
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    vg_assert_null(errors.list);
+    free(file);
+    free(src);
+
+    src = sum_call_src(QUOSI_VALUE_STACK_SIZE + 1, "=");
+    free(quosi_file_compile_from_src(src, &errors, ctx, NULL, quosi_malloc_allocator()));
+    vg_assert_non_null(errors.list);
+    vg_assert_eq(QUOSI_ERR_STACK_OVERFLOW, errors.list[0].type);
+    quosi_error_list_free(&errors);
+    free(src);
+
+    // '+=' keeps the old value under the call
+    src = sum_call_src(QUOSI_VALUE_STACK_SIZE, "+=");
+    free(quosi_file_compile_from_src(src, &errors, ctx, NULL, quosi_malloc_allocator()));
+    vg_assert_non_null(errors.list);
+    vg_assert_eq(QUOSI_ERR_STACK_OVERFLOW, errors.list[0].type);
+    quosi_error_list_free(&errors);
+    free(src);
+
+    // past what a CALL can encode the parser already refuses
+    src = sum_call_src(256, "=");
+    expect_single_fail(_vango_test_result, QUOSI_ERR_TOO_MANY_ARGUMENTS, src);
+    free(src);
+}
+
+vango_test(duplicate_constant) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_DUPLICATE_CONSTANT,
+        "enum Origin { Twinvayne, Domali, Twinvayne } module Enum START = <Brian: \"Hello there.\"> => EXIT endmod");
+}
+
+vango_test(bad_import) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_BAD_IMPORT,
+        "module Cards(win, lose) START = <Brian: \"Pick a card.\"> => win endmod "
+        "module Brian START = import Cards(EXIT) endmod");
+}
+
+vango_test(no_entry) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_NO_ENTRY,
+        "module Entry Begin = <Brian: \"Hello there.\"> => EXIT endmod");
+}
+
+vango_test(duplicate_vertex) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_DUPLICATE_VERTEX,
+        "module Dup START = <Brian: \"Hello there.\"> => START  START = <Brian: \"Byebye.\"> => EXIT endmod");
+}
+
+vango_test(dangling_edge) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_DANGLING_EDGE,
+        "module Dangle START = <Brian: \"Hello there.\"> => Nowhere endmod");
+}
+
+vango_test(too_many_edges) {
+    // one option past what a proposition index can hold
+    char* src = malloc(1024 * 1024);
+    size_t len = (size_t)sprintf(src, "module Menu START = <Brian: \"Pick.\"> (");
+    for (int i = 0; i <= 65536; i++) len += (size_t)sprintf(src + len, " \"o\" => EXIT");
+    sprintf(src + len, " ) endmod");
+    expect_single_fail(_vango_test_result, QUOSI_ERR_TOO_MANY_EDGES, src);
+    free(src);
+}
+
+static void expect_pinned_fail(VANGO_TEST_PARAMS, const char* src) {
+    // every name maps to key 0, which the host pins
+    const quosiPin pin = { 0, 0 };
+    const quosiCompileOptions pinned = { .opt_level=QUOSI_OPT_DEFAULT, .pins=&pin, .npins=1 };
+    quosiError errors = { 0 };
+    free(quosi_file_compile_from_src(src, &errors, dummy_ctx, &pinned, quosi_malloc_allocator()));
+    vg_assert_non_null(errors.list);
+    vg_assert_eq(QUOSI_ERR_ASSIGN_PINNED, errors.list[0].type);
+    quosi_error_list_free(&errors);
+}
+
+vango_test(assign_pinned) {
+    expect_pinned_fail(_vango_test_result,
+        "module Pin START = <Brian: \"Hello there.\"> :: (x = 5) => B  "
+        "B = if (x == 5) then <Brian: \"Five.\"> => EXIT else <Brian: \"Other.\"> => EXIT end endmod");
+    expect_pinned_fail(_vango_test_result,
+        "module Pin START = if (x:5) then <Brian: \"Five.\"> => EXIT else <Brian: \"Other.\"> => EXIT end endmod");
+}
+
+vango_test(line_id_collision) {
+    // both vertex names hash their first line of module Ids to 239512eb
+    const char* src =
+        "module Ids START = <Brian: \"Hi.\"> => vc5e9  "
+        "vc5e9 = <Brian: \"One.\"> => ve8aac  "
+        "ve8aac = <Brian: \"Two.\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    free(quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator()));
+    vg_assert_eq(2, quosi_error_list_len(&errors));
+    vg_assert_eq(QUOSI_ERR_LINE_ID_COLLISION, errors.list[0].type);
+    vg_assert_eq(QUOSI_ERR_LINE_ID_COLLISION, errors.list[1].type);
+    vg_assert_neq(errors.list[0].span.col, errors.list[1].span.col);
+    quosi_error_list_free(&errors);
+}
+
+vango_test(invalid_utf8) {
+    expect_single_fail(_vango_test_result, QUOSI_ERR_INVALID_UTF8,
+        "module Brian START = <Brian: \"Hello th\xC3re.\"> => EXIT endmod");
+}
+
+vango_test(unreachable_vertex) {
+    const char* src = "module Brian START = <Brian: \"Hello there.\"> => EXIT  orphan = <Brian: \"Anyone?\"> => START endmod";
+    quosiError errors = { 0 };
+    // without the flag a clean list still means success
+    quosiFile* quiet = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(quiet);
+    vg_assert_null(errors.list);
+    free(quiet);
+
+    const quosiCompileOptions warn = { .opt_level=QUOSI_OPT_DEFAULT, .warnings=true };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, &warn, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    vg_assert_eq(1, quosi_error_list_len(&errors));
+    vg_assert_eq(QUOSI_ERR_UNREACHABLE_VERTEX, errors.list[0].type);
+    vg_assert(quosi_error_is_warning(errors.list[0]));
+    vg_assert_eq(UINT32_MAX, quosi_file_vertex(file, 0, "orphan"));
+    quosi_error_list_free(&errors);
+    free(file);
+}
@@ -8,11 +8,12 @@
 #include "quosi/vm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "fsutil.h"
 
 
 static uint32_t dummy_ctxf(const char* key) { (void)key; return 0; }
-static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf };
+static quosiSymbolCtx dummy_ctx = { dummy_ctxf, dummy_ctxf, NULL };
 static uint64_t* vm_ctx(uint32_t key) { (void)key; static uint64_t val = 0; return &val; }
 
 
@@ -20,7 +21,7 @@ vango_test(cmp_example) {
     char* src = read_to_string("examples/brian.qsi");
     vg_assert_non_null(src);
     quosiError errors = { 0 };
-    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, quosi_malloc_allocator());
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
     free(src);
 
     if (errors.list != NULL) {
@@ -40,7 +41,7 @@ vango_test(run_example) {
     char* src = read_to_string("examples/doall.qsi");
     vg_assert_non_null(src);
     quosiError errors = { 0 };
-    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, quosi_malloc_allocator());
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
     free(src);
 
     quosiVm vm;
@@ -80,3 +81,508 @@ vango_test(run_example) {
 }
 */
 
+vango_test(random_arms) {
+    const char* src = "module T START = random with (1) <A: \"a\"> => START (0) <A: \"z\"> => START (3) <A: \"b\"> => START end endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    // equal seeds draw equal sequences, a zero weight arm is never drawn
+    quosiVm vm1, vm2;
+    quosi_vm_init(&vm1, file, "T");
+    quosi_vm_init(&vm2, file, "T");
+    quosi_vm_seed(&vm1, 1234);
+    quosi_vm_seed(&vm2, 1234);
+    uint32_t seen_a = 0, seen_b = 0;
+    for (int i = 0; i < 64; i++) {
+        vg_assert(quosi_vm_exec(&vm1, vm_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(quosi_vm_exec(&vm2, vm_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(strcmp(quosi_vm_line(&vm1), quosi_vm_line(&vm2)) == 0);
+        vg_assert(strcmp(quosi_vm_line(&vm1), "z") != 0);
+        seen_a += strcmp(quosi_vm_line(&vm1), "a") == 0;
+        seen_b += strcmp(quosi_vm_line(&vm1), "b") == 0;
+    }
+    vg_assert(seen_a > 0 && seen_b > seen_a);
+    free(file);
+}
+
+vango_test(visit_counters) {
+    const char* src =
+        "module T START = <A: \"s\"> => m  m = if (once) then <A: \"first\"> => c else <A: \"again\"> => c end "
+        "c = if (visits(m) >= 3) then <A: \"done\"> => EXIT else <A: \"loop\"> => m end endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    const char* expect[] = { "s", "first", "loop", "again", "loop", "again", "done" };
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+        vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(strcmp(quosi_vm_line(&vm), expect[i]) == 0);
+    }
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_EXIT);
+    free(file);
+}
+
+static uint64_t native_max(const uint64_t* args, uint32_t argc) {
+    uint64_t m = 0;
+    for (uint32_t i = 0; i < argc; i++) if (args[i] > m) m = args[i];
+    return m;
+}
+static uint32_t native_lkp(const char* name) { return (strcmp(name, "max") == 0) ? 0 : UINT32_MAX; }
+
+vango_test(native_call) {
+    const char* src = "module T START = if (max(k, 7, 3) == 7) then <A: \"seven\"> => EXIT else <A: \"other\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx ctx = { dummy_ctxf, dummy_ctxf, native_lkp };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    const quosiVmNative natives[] = { native_max };
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    quosi_vm_bind(&vm, natives, 1);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "seven") == 0);
+    free(file);
+}
+
+static uint64_t mood = 0;
+static uint64_t* mood_ctx(uint32_t key) { (void)key; return &mood; }
+
+vango_test(enum_match) {
+    const char* src =
+        "enum Mood { Calm, Angry, Sad } module T START = match (m) with (Mood.Calm) <A: \"calm\"> => EXIT "
+        "(Mood.Angry) <A: \"angry\"> => EXIT (Mood.Sad) <A: \"sad\"> => EXIT (_) <A: \"other\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    const char* expect[] = { "calm", "angry", "sad", "other" };
+    for (uint64_t m = 0; m < 4; m++) {
+        quosiVm vm;
+        quosi_vm_init(&vm, file, "T");
+        mood = m;
+        vg_assert(quosi_vm_exec(&vm, mood_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(strcmp(quosi_vm_line(&vm), expect[m]) == 0);
+    }
+    free(file);
+}
+
+vango_test(import_frames) {
+    const char* src =
+        "module Main START = <A: \"main\"> => call  call = import Sub(back, EXIT)  back = <A: \"back\"> => EXIT endmod "
+        "module Sub(ok, bail) START = <A: \"sub\"> => ok endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    // the exit parameter returns through the importer's frame
+    const char* expect[] = { "main", "sub", "back" };
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "Main");
+    for (size_t i = 0; i < 3; i++) {
+        vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(strcmp(quosi_vm_line(&vm), expect[i]) == 0);
+    }
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_EXIT);
+
+    // entered directly there is no frame, so the exit parameter ends the conversation
+    quosi_vm_init(&vm, file, "Sub");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "sub") == 0);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_EXIT);
+    free(file);
+}
+
+vango_test(template_segments) {
+    const char* src = "module T START = <Brian: \"Good on ye ${player}.\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    const uint32_t tmpl = quosi_vm_line_template(&vm);
+    vg_assert(tmpl != QUOSI_TEMPLATE_NONE);
+    vg_assert(quosi_vm_template_len(&vm, tmpl) == 3);
+    const quosiTextSegment key = quosi_vm_template_segment(&vm, tmpl, 1);
+    vg_assert(key.key != QUOSI_SEGMENT_LITERAL && key.len == 6 && strncmp(key.text, "player", 6) == 0);
+    const quosiTextSegment tail = quosi_vm_template_segment(&vm, tmpl, 2);
+    vg_assert(tail.key == QUOSI_SEGMENT_LITERAL && tail.len == 1 && tail.text[0] == '.');
+    free(file);
+}
+
+vango_test(event_ids) {
+    const char* src = "module T START = <A: \"a\"> :: (wave, bow, wave) => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    vg_assert_eq(2, quosi_file_event_count(file));
+
+    // repeated names share one ID, which names the event in the file's table
+    const uint32_t ids[] = { 0, 1, 0 };
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    for (size_t i = 0; i < 3; i++) {
+        vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_EVENT);
+        vg_assert_eq(ids[i], quosi_vm_id(&vm));
+        vg_assert(strcmp(quosi_file_event(file, ids[i]), quosi_vm_line(&vm)) == 0);
+    }
+    vg_assert(quosi_file_event(file, 2) == NULL);
+    free(file);
+}
+
+static uint32_t speaker_initial(const char* key) { return (uint32_t)key[0]; }
+
+vango_test(line_ids) {
+    const char* src = "module T START = <Bob: \"hi\", \"there\"> => EXIT endmod";
+    const char* edited = "module T START = <Bob: \"hi\", \"there\"> => more  more = <Bob: \"new\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx speaker_ctx = { dummy_ctxf, speaker_initial, NULL };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, speaker_ctx, NULL, quosi_malloc_allocator());
+    quosiFile* next = quosi_file_compile_from_src(edited, &errors, speaker_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    vg_assert_non_null(next);
+
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    const uint32_t first = quosi_vm_line_id(&vm);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    const uint32_t second = quosi_vm_line_id(&vm);
+    vg_assert(second != first);
+
+    const quosiFileLine line = quosi_file_line_find(file, first);
+    vg_assert(strcmp(line.text, "hi") == 0);
+    vg_assert_eq('B', line.speaker);
+    // adding a vertex elsewhere leaves the IDs of existing lines alone
+    vg_assert(strcmp(quosi_file_line_find(next, first).text, "hi") == 0);
+    const uint32_t missing = (first + 1 == second) ? first + 2 : first + 1;
+    vg_assert(quosi_file_line_find(file, missing).text == NULL);
+    free(file);
+    free(next);
+}
+
+vango_test(line_views) {
+    const char* src = "module T START = <A: \"h\xC3\xA9llo\", \"\", \"plain text\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    // lengths are in bytes and match the NUL terminated text
+    const size_t lens[] = { 6, 0, 10 };
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    for (size_t i = 0; i < 3; i++) {
+        vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+        const quosiStrView view = quosi_vm_line_view(&vm);
+        vg_assert_eq(lens[i], view.len);
+        vg_assert(view.ptr == quosi_vm_line(&vm) && view.ptr[view.len] == 0);
+    }
+    free(file);
+}
+
+vango_test(large_menu) {
+    char src[4096] = "module M START = <A: \"pick\"> (";
+    for (int i = 0; i < 40; i++) sprintf(src + strlen(src), " \"o%d\" => EXIT", i);
+    strcat(src, " ) endmod");
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "M");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_ABORT);
+
+    quosiProposition props[64];
+    quosi_vm_restart(&vm, file, "M");
+    quosi_vm_prop_buffer(&vm, props, 64);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_PICK);
+    vg_assert(quosi_vm_nq(&vm) == 40 && quosi_vm_choice_len(&vm) == 40);
+    uint64_t mask;
+    quosi_vm_prop_mask(&vm, &mask, 1);
+    vg_assert(mask == ((uint64_t)1 << 40) - 1);
+    free(file);
+}
+
+vango_test(init_at_vertex) {
+    const char* src = "module M START = <A: \"a\"> => mid  mid = <A: \"b\"> => zed  zed = <A: \"c\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    quosiVm vm;
+    vg_assert(quosi_vm_init_at(&vm, file, "M", "zed"));
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "c") == 0);
+    vg_assert(quosi_vm_init_at(&vm, file, "M", "mid"));
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "b") == 0);
+    vg_assert(!quosi_vm_init_at(&vm, file, "M", "missing"));
+    free(file);
+}
+
+vango_test(breakpoint) {
+    const char* src = "module M START = <A: \"a\"> => mid  mid = <A: \"b\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    quosiFile* dbg = quosi_file_debug_copy(file, quosi_malloc_allocator());
+    const uint32_t mid = quosi_file_vertex(dbg, 0, "mid");
+    vg_assert(quosi_file_set_break(dbg, 0, mid));
+    // inside the operands of the instruction at mid
+    vg_assert(!quosi_file_set_break(dbg, 0, mid + 1));
+
+    quosiVm vm;
+    quosi_vm_init(&vm, dbg, "M");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_BREAK);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "b") == 0);
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_EXIT);
+
+    vg_assert(quosi_file_clear_break(dbg, 0, mid));
+    vg_assert(memcmp(dbg, file, quosi_file_len(file)) == 0);
+    free(dbg);
+    free(file);
+}
+
+static uint32_t loads = 0;
+static uint64_t* counting_ctx(uint32_t key) { (void)key; static uint64_t val = 0; loads++; return &val; }
+
+vango_test(short_circuit) {
+    const char* src = "module T START = if (x && y || z && w) then <A: \"yes\"> => EXIT else <A: \"no\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    // x and z are false, so neither y nor w is asked for
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    loads = 0;
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "no") == 0);
+    vg_assert(loads == 2);
+    free(file);
+}
+
+static uint32_t initial_ctxf(const char* key) { return (uint32_t)key[0]; }
+
+vango_test(reuse_loads) {
+    const char* src = "module T START = <A: \"a\"> :: ( t = a + b, a = b, b = t ) => EXIT endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx initial_ctx = { initial_ctxf, dummy_ctxf, NULL };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, initial_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    // b and t come back from temporaries, only a and b are fetched plus the three stores
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_LINE);
+    loads = 0;
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_EXIT);
+    vg_assert(loads == 5);
+    free(file);
+}
+
+vango_test(sparse_match) {
+    const char* src =
+        "module T START = <A: \"s\"> :: (k = 42) => m "
+        "m = match (k) with (1) <A: \"1\"> => EXIT (3) <A: \"3\"> => EXIT (100) <A: \"100\"> => EXIT "
+        "(42) <A: \"42\"> => EXIT (5000) <A: \"5000\"> => EXIT (_) <A: \"_\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "42") == 0);
+    free(file);
+}
+
+vango_test(fold_constants) {
+    const char* src = "module T START = if (2 + 2 == 4) then <A: \"yes\"> => EXIT else <A: \"no\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    const quosiCompileOptions none = { .opt_level=QUOSI_OPT_NONE };
+    quosiFile* plain = quosi_file_compile_from_src(src, &errors, dummy_ctx, &none, quosi_malloc_allocator());
+    quosiFile* folded = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(plain);
+    vg_assert_non_null(folded);
+    vg_assert(quosi_file_line_count(plain) == 2);
+    vg_assert(quosi_file_line_count(folded) == 1);
+    vg_assert(quosi_file_code_len(folded) < quosi_file_code_len(plain));
+
+    quosiVm vm;
+    quosi_vm_init(&vm, folded, "T");
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "yes") == 0);
+    free(plain);
+    free(folded);
+}
+
+vango_test(inline_vertex) {
+    const char* src = "module T START = <A: \"a\"> => last  mid = <A: \"b\"> => EXIT  last = <A: \"c\"> => mid endmod";
+    quosiError errors = { 0 };
+    const quosiCompileOptions none = { .opt_level=QUOSI_OPT_NONE };
+    quosiFile* plain = quosi_file_compile_from_src(src, &errors, dummy_ctx, &none, quosi_malloc_allocator());
+    const quosiCompileOptions full = { .opt_level=QUOSI_OPT_FULL };
+    quosiFile* inlined = quosi_file_compile_from_src(src, &errors, dummy_ctx, &full, quosi_malloc_allocator());
+    vg_assert_non_null(plain);
+    vg_assert_non_null(inlined);
+    // laid out as START, last, mid, so both JUMPs between them are gone
+    vg_assert(quosi_file_code_len(inlined) + 10 == quosi_file_code_len(plain));
+
+    quosiVm vm;
+    vg_assert(quosi_vm_init_at(&vm, inlined, "T", "mid"));
+    vg_assert(quosi_vm_exec(&vm, vm_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "b") == 0);
+    free(plain);
+    free(inlined);
+}
+
+static uint64_t store[128];
+static uint64_t* store_ctx(uint32_t key) { return &store[key % 128]; }
+
+vango_test(shared_tail) {
+    const char* src =
+        "module A START = <X: \"a\"> ( \"one\" :: (g += 5, s = 1) => EXIT \"two\" => EXIT ) endmod "
+        "module B START = <X: \"b\"> ( \"uno\" :: (g += 5, s = 1) => EXIT \"dos\" :: (g += 5, s = 1) => EXIT ) endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx initial_ctx = { initial_ctxf, dummy_ctxf, NULL };
+    const quosiCompileOptions none = { .opt_level=QUOSI_OPT_NONE };
+    quosiFile* plain = quosi_file_compile_from_src(src, &errors, initial_ctx, &none, quosi_malloc_allocator());
+    const quosiCompileOptions full = { .opt_level=QUOSI_OPT_FULL };
+    quosiFile* shared = quosi_file_compile_from_src(src, &errors, initial_ctx, &full, quosi_malloc_allocator());
+    vg_assert_non_null(plain);
+    vg_assert_non_null(shared);
+    vg_assert(quosi_file_code_len(shared) < quosi_file_code_len(plain));
+
+    // both modules run the one copy of the effects
+    memset(store, 0, sizeof(store));
+    const char* mods[] = { "A", "B" };
+    const uint64_t picks[] = { 0, 1 };
+    for (size_t i = 0; i < 2; i++) {
+        quosiVm vm;
+        quosi_vm_init(&vm, shared, mods[i]);
+        vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_LINE);
+        vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_PICK);
+        for (uint32_t j = quosi_vm_nq(&vm); j > 0; j--) quosi_vm_dequeue_text(&vm);
+        quosi_vm_push_value(&vm, picks[i]);
+        vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_EXIT);
+    }
+    vg_assert(store['g'] == 10 && store['s'] == 1);
+    free(plain);
+    free(shared);
+}
+
+vango_test(profile_layout) {
+    const char* src =
+        "module T START = if (k == 1) then <A: \"one\"> => cold else if (k == 2) then <A: \"two\"> => hot "
+        "else <A: \"none\"> => EXIT end  cold = <A: \"c\"> => EXIT  hot = <A: \"h\"> => EXIT endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx initial_ctx = { initial_ctxf, dummy_ctxf, NULL };
+    const quosiCompileOptions probed = { .opt_level=QUOSI_OPT_DEFAULT, .probes=true };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, initial_ctx, &probed, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    // START, both arms, cold and hot
+    vg_assert(quosi_file_probe_count(file) == 5);
+
+    uint32_t counts[5] = { 0 };
+    memset(store, 0, sizeof(store));
+    store['k'] = 2;
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    quosi_vm_profile(&vm, counts, 5);
+    while (quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(counts[0] == 1 && counts[1] == 0 && counts[2] == 1 && counts[3] == 0 && counts[4] == 1);
+    free(file);
+
+    // hot moves ahead of cold, and the second arm is tested first
+    const quosiCompileOptions guided = { .opt_level=QUOSI_OPT_FULL, .profile=counts, .profile_len=5 };
+    file = quosi_file_compile_from_src(src, &errors, initial_ctx, &guided, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    vg_assert(quosi_file_vertex(file, 0, "hot") < quosi_file_vertex(file, 0, "cold"));
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "two") == 0);
+    vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "h") == 0);
+    store['k'] = 1;
+    quosi_vm_init(&vm, file, "T");
+    vg_assert(quosi_vm_exec(&vm, store_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "one") == 0);
+    free(file);
+}
+
+vango_test(pinned_keys) {
+    const char* src =
+        "module T START = if (o == 1) then <A: \"one\"> => EXIT else if (o == 2 && c) then <A: \"two\"> => EXIT "
+        "else <A: \"none\"> => EXIT end endmod";
+    quosiError errors = { 0 };
+    const quosiSymbolCtx initial_ctx = { initial_ctxf, dummy_ctxf, NULL };
+    const quosiPin pins[] = { { 'o', 2 }, { 'c', 1 } };
+    const quosiCompileOptions pinned = { .opt_level=QUOSI_OPT_DEFAULT, .pins=pins, .npins=2 };
+    quosiFile* plain = quosi_file_compile_from_src(src, &errors, initial_ctx, NULL, quosi_malloc_allocator());
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, initial_ctx, &pinned, quosi_malloc_allocator());
+    vg_assert_non_null(plain);
+    vg_assert_non_null(file);
+    vg_assert(quosi_file_code_len(file) < quosi_file_code_len(plain));
+
+    // every condition folded, nothing is asked of the host
+    quosiVm vm;
+    quosi_vm_init(&vm, file, "T");
+    loads = 0;
+    vg_assert(quosi_vm_exec(&vm, counting_ctx) == QUOSI_UPCALL_LINE);
+    vg_assert(strcmp(quosi_vm_line(&vm), "two") == 0);
+    vg_assert(loads == 0);
+    free(plain);
+    free(file);
+}
+
+static uint32_t lookups = 0;
+static uint32_t counting_lkp(const char* key) { lookups++; return (uint32_t)key[0]; }
+
+vango_test(interned_symbols) {
+    quosiError errors = { 0 };
+    const quosiSymbolCtx ctx = { counting_lkp, counting_lkp, NULL };
+    lookups = 0;
+    quosiFile* file = quosi_file_compile_from_src(
+        "module T START = <Ann: \"a\"> :: (x += 1) => Next  Next = if (x == 2 && y) then <Ann: \"b\"> => EXIT "
+        "else <Bob: \"c\"> :: (x = y) => EXIT end endmod",
+        &errors, ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+    // x, y, Ann and Bob, however often each is named
+    vg_assert_eq(4, lookups);
+    free(file);
+}
+
+vango_test(file_build) {
+    const char* src = "module T START = <Ann: \"Hello there.\"> :: (x += 1) => EXIT endmod";
+    quosiError errors = { 0 };
+    quosiFile* file = quosi_file_compile_from_src(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(file);
+
+    quosiFileBuild* build = quosi_file_build(src, &errors, dummy_ctx, NULL, quosi_malloc_allocator());
+    vg_assert_non_null(build);
+    vg_assert_null(errors.list);
+    const size_t size = quosi_file_build_size(build);
+    vg_assert_eq(quosi_file_header(file)->fsize, size);
+    uint8_t* buf = malloc(size);
+    quosi_file_build_write(build, buf);
+    vg_assert(memcmp(buf, file, size) == 0);
+    quosi_file_build_free(build);
+
+    vg_assert_null(quosi_file_build("module T START = <Ann: \"Hi\"> => nowhere endmod", &errors, dummy_ctx, NULL, quosi_malloc_allocator()));
+    vg_assert_non_null(errors.list);
+    quosi_error_list_free(&errors);
+    free(buf);
+    free(file);
+}